@@ -0,0 +1,283 @@
+/*
+ * file: bench.cpp
+ * 
+ * Benchmark of the cachesim library, built and run with make bench.
+ * Measures the accesses per second of each stage on its own, decoding
+ * a trace, simulating accesses already decoded and both together, for
+ * synthetic traces of the library and the traces given with -f.
+ */
+
+// separation line for printing
+#define SEP_TABLE "#########################################\n"
+
+#include <getopt.h>
+#include <chrono>
+#include "cachesim.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace cachesim;
+
+// synthetic patterns of the benchmark
+static const int bench_patterns[] = {SYNTH_SEQ, SYNTH_RANDOM, SYNTH_STRIDE};
+
+// stride of the strided pattern in bytes, not a power of two
+#define BENCH_STRIDE 4160
+
+/*
+ * Reads a text trace kept in memory, to time the parser without the
+ * reads of the file.
+ */
+class MemorySource : public ByteSource
+{
+private:
+	const string &text;	// contents of the trace
+	size_t pos;	// next byte to read
+
+public:
+	MemorySource(const string &t) : text(t)
+	{
+		pos = 0;
+	}
+
+	long read(char *dst, size_t n)
+	{
+		n = min(n, text.size()-pos);
+		memcpy(dst, text.data()+pos, n);
+		pos += n;
+		return n;
+	}
+};
+
+/*
+ * Writes accesses as a text trace.
+ * 
+ * @param[in] accesses	Accesses to write.
+ * @param[out] text	Lines of the trace.
+ */
+void format_trace(const vector<Access> &accesses, string &text)
+{
+	char line[64];
+	text.clear();
+	text.reserve(accesses.size()*20);
+	for (const Access &a : accesses)
+	{
+		int n = snprintf(line, sizeof(line), "# %d %" PRIx64 " 1\n", a.ls, a.phy_addr);
+		text.append(line, n);
+	}
+}
+
+/*
+ * Decodes all the accesses of a source.
+ * 
+ * @param[in] src	Accesses to decode.
+ * @param[out] out	Accesses decoded.
+ */
+void read_accesses(AccessSource *src, vector<Access> &out)
+{
+	const Access *batch;
+	size_t n;
+	out.clear();
+	while (src->next(batch, n))
+		out.insert(out.end(), batch, batch+n);
+}
+
+/*
+ * Simulates the accesses of a source in a cache.
+ * 
+ * @param[in] src	Accesses to simulate.
+ * @param[in] ch	Cache that runs them.
+ * @returns uint64_t	Number of accesses.
+ */
+uint64_t simulate(AccessSource *src, CacheModel &ch)
+{
+	const Access *batch;
+	size_t n;
+	while (src->next(batch, n))
+		ch.run_batch(batch, n);
+	return ch.get_access_cnt();
+}
+
+/*
+ * Runs a stage of the benchmark several times.
+ * 
+ * @param[in] stage	Function that runs the stage once, returns the
+ * 					accesses it handled.
+ * @param[in] repeats	Number of runs.
+ * @param[out] accesses	Accesses of one run.
+ * @returns double	Time of the fastest run in ns.
+ */
+template<class Stage>
+double best_time(Stage stage, int repeats, uint64_t &accesses)
+{
+	double best = 0;
+	for (int r=0; r<repeats; r++)
+	{
+		auto start = high_resolution_clock::now();
+		accesses = stage();
+		auto stop = high_resolution_clock::now();
+		double ns = duration_cast<nanoseconds>(stop-start).count();
+		if (r == 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+/*
+ * Prints the throughput of a stage.
+ * 
+ * @param[in] input	Name of the pattern or the trace.
+ * @param[in] stage	Name of the stage.
+ * @param[in] policy	Replacement policy, -1 if none is simulated.
+ * @param[in] ways	Associativity, 0 if no cache is simulated.
+ * @param[in] accesses	Accesses of the stage.
+ * @param[in] ns	Time of the stage in ns.
+ */
+void print_bench(const string &input, const char *stage, int policy, int ways,
+	uint64_t accesses, double ns)
+{
+	double per_access = accesses ? ns/accesses : 0.0;
+	double rate = (ns > 0) ? accesses*1e3/ns : 0.0;
+	printf("%-16s%-12s%-8s%-6s%-16.2f%-10.2f\n", input.c_str(), stage,
+		(policy < 0) ? "-" : policy_names[policy],
+		(ways == 0) ? "-" : to_string(ways).c_str(), rate, per_access);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+	size_t n = 1<<22;
+	int repeats = 3;
+	int size = 32;
+	int block = 64;
+	vector<int> ways = {1, 2, 4, 8, 16, 32};
+	vector<int> policies(1, POLICY_SRRIP);
+	vector<const char*> traces;
+	int c;
+	// -n synthetic accesses, -r runs of each stage, -t, -a, -l and -p the
+	// caches simulated and -f traces measured besides the synthetic ones
+	while ((c = getopt(argc, argv, "n:r:t:a:l:p:f:")) != -1)
+		switch (c)
+		{
+			case 'n':
+				n = strtoull(optarg, nullptr, 10);
+				break;
+			case 'r':
+				repeats = max(stoi(optarg), 1);
+				break;
+			case 't':
+				size = stoi(optarg);
+				break;
+			case 'a':
+				ways = parse_list(optarg);
+				break;
+			case 'l':
+				block = stoi(optarg);
+				break;
+			case 'p':
+				policies = parse_policies(optarg);
+				break;
+			case 'f':
+				traces.push_back(optarg);
+				break;
+			default:
+				return 1;
+		}
+	for (int w : ways)
+		for (int p : policies)
+		{
+			CacheConfig cfg = {size, w, block, p};
+			string error;
+			if (!check_config(cfg, error))
+			{
+				fprintf(stderr, "%s\n", error.c_str());
+				return 1;
+			}
+		}
+
+	// text and decoded accesses of the inputs
+	vector<string> names;
+	vector<string> texts;
+	vector<vector<Access>> decoded;
+	for (int kind : bench_patterns)
+	{
+		// default working set and stores of the synthetic traces
+		SyntheticConfig synth = synthetic_defaults(kind);
+		synth.accesses = n;
+		if (kind == SYNTH_STRIDE)
+			synth.stride = BENCH_STRIDE;
+		unique_ptr<AccessSource> src(open_synthetic(synth));
+		names.push_back(synthetic_names[kind]);
+		decoded.emplace_back();
+		read_accesses(src.get(), decoded.back());
+		texts.emplace_back();
+		format_trace(decoded.back(), texts.back());
+	}
+	for (const char *path : traces)
+	{
+		unique_ptr<AccessSource> src(open_accesses(path));
+		if (!src)
+		{
+			fprintf(stderr, "can't open trace %s\n", path);
+			return 1;
+		}
+		const char *base = strrchr(path, '/');
+		names.push_back(base ? base+1 : path);
+		decoded.emplace_back();
+		read_accesses(src.get(), decoded.back());
+		texts.emplace_back();
+	}
+
+	printf(SEP_TABLE);
+	printf("# Benchmark, fastest of %d runs\n", repeats);
+	printf("%-16s%-12s%-8s%-6s%-16s%-10s\n", "input", "stage", "policy", "ways",
+		"Maccesses/s", "ns/access");
+	for (size_t k=0; k<names.size(); k++)
+	{
+		bool is_trace = k >= 3;
+		const char *path = is_trace ? traces[k-3] : nullptr;
+		const string &text = texts[k];
+		const vector<Access> &accesses = decoded[k];
+		uint64_t cnt;
+		double ns;
+
+		// parse only, the traces are read from the file too
+		ns = best_time([&]() -> uint64_t {
+			vector<Access> out;
+			unique_ptr<AccessSource> src(is_trace ? open_accesses(path) :
+				open_text_accesses(new MemorySource(text)));
+			read_accesses(src.get(), out);
+			return out.size();
+		}, repeats, cnt);
+		print_bench(names[k], "parse", -1, 0, cnt, ns);
+
+		// simulate only, over the decoded accesses
+		for (int p : policies)
+			for (int w : ways)
+			{
+				ns = best_time([&]() -> uint64_t {
+					unique_ptr<CacheModel> ch(make_cache(size, w, block, p));
+					for (size_t i=0; i<accesses.size(); i+=ACCESS_BATCH_SIZE)
+						ch->run_batch(&accesses[i], min((size_t)ACCESS_BATCH_SIZE, accesses.size()-i));
+					return ch->get_access_cnt();
+				}, repeats, cnt);
+				print_bench(names[k], "simulate", p, w, cnt, ns);
+			}
+
+		// parse and simulate, like the simulator does
+		for (int p : policies)
+			for (int w : ways)
+			{
+				ns = best_time([&]() -> uint64_t {
+					unique_ptr<CacheModel> ch(make_cache(size, w, block, p));
+					unique_ptr<AccessSource> src(is_trace ? open_accesses(path) :
+						open_text_accesses(new MemorySource(text)));
+					return simulate(src.get(), *ch);
+				}, repeats, cnt);
+				print_bench(names[k], "end-to-end", p, w, cnt, ns);
+			}
+	}
+	printf("\n");
+
+	return 0;
+}
@@ -4,611 +4,1375 @@
  * 
  * This program simulates a cache using the SRRIP replacement policy
  * the associativity, cache line size and cache size may be passed
- * from the command line (see readme.md).
+ * from the command line (see readme.md), the BRRIP, DRRIP, LRU and
+ * tree PLRU policies may be selected too.
  * 
- * Objects:
- * To simulate this cache several objects are used, at the top level
- * a cache objects takes instructions(read/store) and
- * executes/simulates them, this object uses a hashmap of Sets objects
- * where the keys are the index bits and the Sets objects have a vector
- * of cache lines, which are modeled using the Way class.
+ * The model of the caches is the cachesim library (cachesim.h), this
+ * file is its command line: it parses the options, runs the trace in
+ * the caches and prints the results.
+ * 
+ * Building with -DCACHE_STATS (make cache_stats) adds per set and per
+ * instruction counters, the default build doesn't have them.
  */
 
 // separation line for printing
 #define SEP_TABLE "#########################################\n"
 
 #include <iostream>
-#include <stdlib.h>
-#include <unistd.h>
-#include <string>
+#include <getopt.h>
 #include <chrono>
-#include <math.h>
-#include <unordered_map>
-#include <vector>
+#include "cachesim.h"
 
 using namespace std;
 using namespace std::chrono;
+using namespace cachesim;
 
 
 /*
- * Extracts a sequence of bits from an integer number given a
- * superior and inferior limit.
- * 
- * @param[in] num	Integer number.
- * @param[in] h_lim	Superior bit index.
- * @param[in] l_lim	Inferior bit index.
- * @return int 		Number given by the sequence of bits.
+ * Computes the LRU miss ratio of every configuration, and of a fully
+ * associative cache of every size, in a single pass over a trace.
  * 
+ * @param[in] trace	Accesses of the trace.
+ * @param[in] configs	Configurations to profile.
  */
-int bit_crop(int num, int h_lim, int l_lim)
+void profile_trace(AccessSource *trace, const vector<CacheConfig> &configs)
 {
-	return (num%((unsigned long)1<<h_lim))>>l_lim;
-}
+	// a profile for each block size
+	vector<unique_ptr<StackProfile>> profiles;
+	for (const CacheConfig &cfg : configs)
+	{
+		bool seen = false;
+		for (unique_ptr<StackProfile> &p : profiles)
+			seen |= p->get_block_size() == cfg.block;
+		if (seen)
+			continue;
+		long max_lines = 0;
+		int max_ways = 0;
+		vector<long> sets;
+		for (const CacheConfig &c : configs)
+		{
+			if (c.block != cfg.block)
+				continue;
+			max_lines = max(max_lines, (long)c.size*1024/c.block);
+			max_ways = max(max_ways, c.ways);
+			if (find(sets.begin(), sets.end(), config_sets(c)) == sets.end())
+				sets.push_back(config_sets(c));
+		}
+		profiles.emplace_back(new StackProfile(cfg.block, max_lines, sets, max_ways));
+	}
 
+	const Access *batch;
+	size_t n;
+	while (trace->next(batch, n))
+	{
+		for (unique_ptr<StackProfile> &p : profiles)
+		{
+			for (size_t k=0; k<n; k++)
+				p->access(batch[k].phy_addr);
+		}
+	}
+
+	for (unique_ptr<StackProfile> &p : profiles)
+	{
+		printf("\n");
+		printf(SEP_TABLE);
+		printf("# LRU stack distance profile:\n");
+		printf("%-30s%-10d\n", "Cache block size:", p->get_block_size());
+		printf("%-30s%-10" PRIu64 "\n", "Accesses:", p->get_accesses());
+		printf("%-30s%-10" PRIu64 "\n", "Distinct lines:", p->get_lines());
+		printf("\n");
+		printf(SEP_TABLE);
+		printf("%-10s%-10s%-10s%-10s\n", "# KB", "Ways", "Assoc", "Full");
+		for (const CacheConfig &cfg : configs)
+		{
+			if (cfg.block != p->get_block_size())
+				continue;
+			printf("%-10d%-10d%-10.4f%-10.4f\n", cfg.size, cfg.ways,
+				p->set_miss_rate(config_sets(cfg), cfg.ways),
+				p->full_miss_rate((long)cfg.size*1024/cfg.block));
+		}
+		printf("\n");
+	}
+}
 
 /*
- * Class to model a cache using the SRRIP replacement policy.
+ * Checks that a configuration can be simulated, printing the error.
+ * 
+ * @param[in] cfg	Configuration to check.
+ * @returns bool	True if the configuration is valid.
  */
-class CacheSRRIP
+bool valid_config(const CacheConfig &cfg)
 {
-private:
-	int cache_s;	// cache size in KB
-	int cache_w;	// cache associativity
-	int cache_b;	// cache block size in bytes
-	int index_offset;	// offset of the index bits
-	int tag_offset;	// offset of the tag bits
-	int srrip_m;	// value of M for SRRIP policy
-	int access_cnt;	// access counter
-	int read_hit_cnt;	// read hit counter
-	int store_hit_cnt;	// store hit counter
-	int read_misses_cnt; // read misses counter
-	int store_misses_cnt;	// store misses counter
-	int dirty_evicts_cnt;	// dirty evictions counter
-
-public:
+	string error;
+	if (!check_config(cfg, error))
+	{
+		fprintf(stderr, "%s\n", error.c_str());
+		return false;
+	}
+	return true;
+}
 
-	/*
-	 * Class representing a cache line.
-	 */
-	class Way
-	{
-	private:
-		int tag;	// tag bits of the current line
-		int rrpv;	// RRPV value
-		int dirty_bit;	// 
-	public:
-
-	/*
-	 * Constructor for cache line objects.
-	 * 
-	 * @param[in] max_rrpv	Max value for the RRPV parameter.
-	 */
-	Way(int max_rrpv)
-	{
-		rrpv = max_rrpv;	// defaults to max value
-		tag = -1;	// defaults tag to -1
-		dirty_bit = 0;	// clean by default
-	}
-
-	/*
-	 * Modifies the tag of the cache line.
-	 * 
-	 * @param[in] t	New tag to be set.
-	 */
-	void set_tag(int t)
-	{
-		tag = t;
-	}
-
-	/*
-	 * Returns the tag of this cache line.
-	 * 
-	 * @return int	The tag of this cache line.
-	 */
-	int get_tag()
-	{
-		return tag;
-	}
-
-	/*
-	 * Modifies the RRPV value of the this cache line.
-	 * 
-	 * @param[in] v	New value of RRPV.
-	 */
-	void set_rrpv(int v)
-	{
-		rrpv=v;
-	}
-
-	/*
-	 * Returns the RRPV value of this cache line.
-	 *
-	 * @return int	The RRPV value of this cache line.
-	 */
-	int get_rrpv()
-	{
-		return rrpv;
-	}
-
-	/*
-	 * Sets to 1 the dirty bit of this cache line.
-	 */
-	void set_dirty_bit()
-	{
-		dirty_bit = 1;
-	}
-
-	/*
-	 * Clears the dirty bit of this cache line.
-	 */
-	void clear_dirty_bit()
-	{
-		dirty_bit = 0;
-	}
-
-	/*
-	 * Returns the dirty bit of this cache line.
-	 * 
-	 * @param[in] int Dirty bit of this cache line (1/0).
-	 */
-	int get_dirty_bit()
-	{
-		return dirty_bit;
-	}
-};
-
-	/*
-	 * This class models the sets of the cache, each with N posible
-	 * ways, the number of ways is set from command line.
-	 */
-	class Set
+/*
+ * Parses a prefetcher given as its name and optionally :degree, like
+ * "stride:4".
+ * 
+ * @param[in] str	Prefetcher to parse.
+ * @param[out] kind	PrefetchKind of the prefetcher.
+ * @param[out] degree	Lines prefetched ahead of each trigger.
+ * @returns bool	False if the prefetcher is unknown or malformed.
+ */
+bool parse_prefetch(const char *str, int &kind, int &degree)
+{
+	string name(str);
+	size_t colon = name.find(':');
+	degree = -1;
+	if (colon != string::npos)
 	{
-	private:
-		int s_size;	// set size (associativity)
-		int srrip_m;	// value of M for SRRIP
-		int max_rrpv;  // max value for rrpv value
-		vector<Way> ways;	// ways of this set
-		
-	public:
-		
-		/*
-		 * Inits instance of a cache Set.
-		 * 
-		 * @param[in] s	Number of ways of this set.
-		 * @param[in] m	M value for SRRIP.
-		 */
-		Set(int s, int m)
+		char *e;
+		degree = strtol(name.c_str()+colon+1, &e, 10);
+		if (*e != '\0' || degree <= 0)
+			return false;
+		name.resize(colon);
+	}
+	for (int k=1; k<(int)(sizeof(prefetch_names)/sizeof(prefetch_names[0])); k++)
+	{
+		if (name == prefetch_names[k])
 		{
-			s_size = s;
-			srrip_m=m;
-			// computes max value of RRPV
-			max_rrpv = pow(2,srrip_m)-1;
-			// creates vector with cache lines
-			for (int k=0;k<s_size;k++)
-			{
-				ways.push_back(Way(max_rrpv));
-			}
+			kind = k;
+			if (degree < 0)
+				degree = prefetch_degrees[k];
+			return true;
 		}
+	}
+	return false;
+}
 
-		/*
-		 * Returns the size of this cache set.
-		 * 
-		 * @returns int	Size of this cache.
-		 */
-		int get_size()
-		{
-			return s_size;
-		}
+/*
+ * Parses a number with an optional K, M or G suffix (powers of 1024).
+ * 
+ * @param[in] str	Number to parse.
+ * @param[out] v	Value of the number.
+ * @returns bool	False if it is malformed.
+ */
+bool parse_size(const char *str, uint64_t &v)
+{
+	char *e;
+	v = strtoull(str, &e, 10);
+	if (e == str)
+		return false;
+	const char *units = "KMG";
+	const char *u = *e ? strchr(units, *e) : nullptr;
+	if (u != nullptr)
+	{
+		v <<= 10*(u-units+1);
+		e++;
+	}
+	return *e == '\0';
+}
 
-		/*
-		 * Searches for a given tag in the set ways.
-		 * 
-		 * @param[in] tag	Tag to search.
-		 * @returns int	Returns 1 if finds the way, and 0 otherwise.
-		 */
-		int read_way(int tag)
+/*
+ * Parses a synthetic trace given as its pattern and optionally
+ * :key=value pairs separated by commas, like "zipf:ws=1G,alpha=1.2".
+ * The keys are n (accesses), ws (working set bytes), stride, streams,
+ * item, alpha, stores and seed.
+ * 
+ * @param[in] str	Synthetic trace to parse.
+ * @param[out] cfg	Parameters of the trace.
+ * @returns bool	False if the pattern or a key is unknown or malformed.
+ */
+bool parse_synthetic(const char *str, SyntheticConfig &cfg)
+{
+	string spec(str);
+	size_t colon = spec.find(':');
+	string name = spec.substr(0, colon);
+	int kind = -1;
+	for (int k=0; k<(int)(sizeof(synthetic_names)/sizeof(synthetic_names[0])); k++)
+	{
+		if (name == synthetic_names[k])
+			kind = k;
+	}
+	if (kind < 0)
+		return false;
+	cfg = synthetic_defaults(kind);
+	size_t start = colon == string::npos ? spec.size()+1 : colon+1;
+	while (start <= spec.size())
+	{
+		size_t end = spec.find(',', start);
+		if (end == string::npos)
+			end = spec.size();
+		string pair = spec.substr(start, end-start);
+		size_t eq = pair.find('=');
+		if (eq == string::npos)
+			return false;
+		string key = pair.substr(0, eq);
+		const char *value = pair.c_str()+eq+1;
+		uint64_t v = 0;
+		char *e;
+		if (key == "alpha" || key == "stores")
 		{
-			for(int k=0; k<s_size; k++)
-			{
-				if(ways[k].get_tag() == tag)
-				{
-					ways[k].set_rrpv(0); // hit then rrpv=0
-					return 1; // hit
-				}
-			}
-			return 0; // miss
+			double d = strtod(value, &e);
+			if (e == value || *e != '\0')
+				return false;
+			(key == "alpha" ? cfg.alpha : cfg.stores) = d;
 		}
+		else if (!parse_size(value, v))
+			return false;
+		else if (key == "n")
+			cfg.accesses = v;
+		else if (key == "ws")
+			cfg.footprint = v;
+		else if (key == "stride")
+			cfg.stride = v;
+		else if (key == "streams")
+			cfg.streams = (int)min<uint64_t>(v, 1<<30);
+		else if (key == "item")
+			cfg.item = v;
+		else if (key == "seed")
+			cfg.seed = v;
+		else
+			return false;
+		start = end+1;
+	}
+	return true;
+}
 
-		/*
-		 * Evicts a line caused by a read request.
-		 * 
-		 * @param[in] tag New tag to set.
-		 * @returns int Returns 1 if there is a dirty eviction,
-		 * 						0 otherwise.
-		 */
-		int read_evict_way(int tag)
+/*
+ * Parses the costs of a cache given as hit:miss:writeback cycles, like
+ * "4:200:50".
+ * 
+ * @param[in] str	Costs to parse.
+ * @param[out] lat	Costs of the cache.
+ * @returns bool	False if the costs are malformed.
+ */
+bool parse_latency(const char *str, LatencyConfig &lat)
+{
+	char end;
+	return sscanf(str, "%d:%d:%d%c", &lat.hit, &lat.miss, &lat.writeback, &end) == 3 &&
+		lat.hit >= 0 && lat.miss >= 0 && lat.writeback >= 0;
+}
+
+/*
+ * Parses the configuration of a level of a hierarchy, given as
+ * size:ways:block and optionally :policy, like "32:8:64:lru".
+ * 
+ * @param[in] str	Level to parse.
+ * @param[out] cfg	Configuration of the level.
+ * @returns bool	False if the level is malformed.
+ */
+bool parse_level(const char *str, CacheConfig &cfg)
+{
+	char policy[32];
+	int n = sscanf(str, "%d:%d:%d:%31s", &cfg.size, &cfg.ways, &cfg.block, policy);
+	if (n < 3)
+		return false;
+	cfg.policy = (n == 4) ? parse_policy(policy) : POLICY_SRRIP;
+	return true;
+}
+
+/*
+ * Parses the partition of a shared cache, "none", "ucp" or "ucp:period"
+ * for UCP, or the ways of each core like "4,2,2".
+ * 
+ * @param[in] str	Partition to parse.
+ * @param[out] kind	PartitionKind of the partition.
+ * @param[out] ways	Ways of each core of a fixed partition.
+ * @param[out] period	Accesses between repartitions of UCP.
+ * @returns bool	The partition is valid.
+ */
+bool parse_partition(const char *str, int &kind, vector<int> &ways, uint64_t &period)
+{
+	if (strcmp(str, "none") == 0)
+	{
+		kind = PARTITION_NONE;
+		return true;
+	}
+	if (strncmp(str, "ucp", 3) == 0)
+	{
+		kind = PARTITION_UCP;
+		if (str[3] == '\0')
+			return true;
+		char *end;
+		period = strtoull(str+4, &end, 10);
+		return str[3] == ':' && *end == '\0' && period > 0;
+	}
+	kind = PARTITION_WAYS;
+	ways = parse_list(str);
+	for (int w : ways)
+	{
+		if (w < 1)
+			return false;
+	}
+	return !ways.empty();
+}
+
+/*
+ * Returns the inclusion policy with the given name.
+ * 
+ * @param[in] name	Name of the policy, like "inclusive".
+ * @returns int	InclusionKind of the policy, -1 if there is none.
+ */
+int parse_inclusion(const char *name)
+{
+	for (int k=0; k<(int)(sizeof(inclusion_names)/sizeof(inclusion_names[0])); k++)
+	{
+		if (strcmp(name, inclusion_names[k]) == 0)
+			return k;
+	}
+	return -1;
+}
+
+/*
+ * Reads a list of configurations from a file, each line has the cache
+ * size, the associativity, the block size and optionally the policy
+ * separated by spaces, empty lines and lines starting with # are
+ * ignored.
+ * 
+ * @param[in] path	Path of the file.
+ * @param[out] configs	Configurations read are appended here.
+ * @returns bool	False if the file can't be read.
+ */
+bool read_configs(const char *path, vector<CacheConfig> &configs)
+{
+	FILE *f = fopen(path, "r");
+	if (f == nullptr)
+		return false;
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		CacheConfig cfg;
+		char policy[32];
+		int n = sscanf(line, "%d %d %d %31s", &cfg.size, &cfg.ways, &cfg.block, policy);
+		if (line[0] != '#' && n >= 3)
 		{
-			while(1)
-			{
-				for(int k=0; k<s_size; k++)
-				{
-					if(ways[k].get_rrpv() == max_rrpv)
-					{
-						// hit then rrpv=max-1
-						ways[k].set_rrpv(max_rrpv-1); 
-						// new tag
-						ways[k].set_tag(tag); 
-						
-						if (ways[k].get_dirty_bit() == 1)
-						{
-							// clear dirty bit
-							ways[k].clear_dirty_bit();
-							return 1;
-						}
-						else
-						{
-							return 0;
-						}
-					}
-				}
-				// increment all RRPV
-				inc_all_rrpv();
-			}
+			cfg.policy = (n == 4) ? parse_policy(policy) : POLICY_SRRIP;
+			configs.push_back(cfg);
 		}
+	}
+	fclose(f);
+	return true;
+}
+
+/*
+ * Prints the parameters and results of a simulated cache.
+ * 
+ * @param[in] cfg	Configuration of the cache.
+ * @param[in] ch	Simulated cache.
+ */
+void print_results(const CacheConfig &cfg, CacheModel &ch)
+{
+	double miss_rate = 0.0;
+	double read_miss_rate = 0.0;
+	uint64_t dirty_evictions_cnt = 0;
+	uint64_t load_misses_cnt = 0;
+	uint64_t store_misses_cnt = 0;
+	uint64_t total_misses_cnt = 0;
+	uint64_t load_hits_cnt = 0;
+	uint64_t store_hits_cnt = 0;
+	uint64_t total_hits_cnt = 0;
+	uint64_t access_cnt = 0;
+
+	store_hits_cnt = ch.get_store_hit_cnt();
+	load_hits_cnt = ch.get_read_hit_cnt();
+	store_misses_cnt = ch.get_store_misses_cnt();
+	load_misses_cnt = ch.get_read_misses_cnt();
+	dirty_evictions_cnt = ch.get_dirty_evicts_cnt();
+	access_cnt = ch.get_access_cnt();
+	total_hits_cnt = load_hits_cnt + store_hits_cnt;
+	total_misses_cnt = load_misses_cnt + store_misses_cnt;
+	
+	// calculate params
+	if (access_cnt > 0)
+	{
+		miss_rate = ((double)load_misses_cnt + store_misses_cnt)/access_cnt;
+		read_miss_rate = (double)load_misses_cnt/access_cnt;
+	}
+
+	// print simulation params
+	printf("\n");
+	printf(SEP_TABLE);
+	printf("# Cache parameters:\n");
+	printf("%-30s%-10d\n", "Cache size (KB):", cfg.size);
+	printf("%-30s%-10d\n", "Cache associativity:", cfg.ways);
+	printf("%-30s%-10d\n", "Cache block size:", cfg.block);
+	printf("%-30s%-10s\n", "Replacement policy:", policy_names[cfg.policy]);
+	printf("\n");
+
+	// print simulation results
+	printf(SEP_TABLE);
+	printf("# Simulation results:\n");
+	printf("%-30s%-10.4f\n", "Overall miss rate:", miss_rate);
+	printf("%-30s%-10.4f\n", "Read miss rate:", read_miss_rate);
+	printf("%-30s%-10" PRIu64 "\n", "Dirty evictions:", dirty_evictions_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Load misses:", load_misses_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Store misses:", store_misses_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Total misses:", total_misses_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Loads hits:", load_hits_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Store hits:", store_hits_cnt);
+	printf("%-30s%-10" PRIu64 "\n", "Total hits:", total_hits_cnt);
+	printf("\n");
+
+	Prefetcher *pf = ch.get_prefetcher();
+	if (pf == nullptr)
+		return;
+	PrefetchCounters pc = ch.get_prefetch_counters();
+	double accuracy = pc.issued ? (double)pc.useful/pc.issued : 0.0;
+	double coverage = (pc.useful+total_misses_cnt) ?
+		(double)pc.useful/(pc.useful+total_misses_cnt) : 0.0;
+	double traffic = total_misses_cnt ? (double)pc.issued/total_misses_cnt : 0.0;
+	string name = string(prefetch_names[pf->get_kind()])+":"+to_string(pf->get_degree());
+	printf(SEP_TABLE);
+	printf("# Prefetch results:\n");
+	printf("%-30s%-10s\n", "Prefetcher:", name.c_str());
+	printf("%-30s%-10" PRIu64 "\n", "Prefetches issued:", pc.issued);
+	printf("%-30s%-10" PRIu64 "\n", "Redundant prefetches:", pc.redundant);
+	printf("%-30s%-10" PRIu64 "\n", "Useful prefetches:", pc.useful);
+	printf("%-30s%-10" PRIu64 "\n", "Unused prefetches:", pc.unused);
+	printf("%-30s%-10" PRIu64 "\n", "Pollution misses:", pc.pollution);
+	printf("%-30s%-10.4f\n", "Prefetch accuracy:", accuracy);
+	printf("%-30s%-10.4f\n", "Prefetch coverage:", coverage);
+	printf("%-30s%-10.4f\n", "Prefetches per demand miss:", traffic);
+	printf("\n");
+}
+
+/*
+ * Prints the average memory access time and the memory traffic of a
+ * cache or a hierarchy. Every access to a level costs its hit latency,
+ * every miss its miss penalty and every modified line it evicts its
+ * writeback cost, the miss penalty of the last level is the latency of
+ * the memory.
+ * 
+ * @param[in] levels	Counters of each level, only accesses, misses
+ * 						and dirty evictions are used.
+ * @param[in] lat	Costs of each level.
+ * @param[in] reads	Lines read from memory.
+ * @param[in] writes	Lines written to memory.
+ * @param[in] block	Block size of the last level.
+ */
+void print_latency(const vector<LevelStats> &levels, const vector<LatencyConfig> &lat,
+	uint64_t reads, uint64_t writes, int block)
+{
+	double cycles = 0.0;
+	for (size_t k=0; k<levels.size(); k++)
+	{
+		cycles += (double)levels[k].accesses*lat[k].hit+
+			(double)levels[k].misses*lat[k].miss+
+			(double)levels[k].dirty_evicts*lat[k].writeback;
+	}
+	uint64_t accesses = levels[0].accesses;
+	double stalls = cycles-(double)accesses*lat[0].hit;
+	double amat = accesses ? cycles/accesses : 0.0;
+	double read_bytes = accesses ? 1000.0*reads*block/accesses : 0.0;
+	double write_bytes = accesses ? 1000.0*writes*block/accesses : 0.0;
+
+	printf(SEP_TABLE);
+	printf("# Memory model:\n");
+	printf("%-30s%-10.4f\n", "AMAT (cycles):", amat);
+	printf("%-30s%-10.0f\n", "Stall cycles:", stalls);
+	printf("%-30s%-10.1f\n", "DRAM read bytes/1K access:", read_bytes);
+	printf("%-30s%-10.1f\n", "DRAM write bytes/1K access:", write_bytes);
+	printf("\n");
+}
+
+/*
+ * Prints the memory model of a single cache, its misses, prefetches
+ * and dirty evictions go to memory.
+ * 
+ * @param[in] cfg	Configuration of the cache.
+ * @param[in] ch	Cache simulated.
+ * @param[in] lat	Costs of the cache.
+ */
+void print_latency(const CacheConfig &cfg, CacheModel &ch, const LatencyConfig &lat)
+{
+	LevelStats st = LevelStats();
+	st.accesses = ch.get_access_cnt();
+	st.misses = ch.get_read_misses_cnt()+ch.get_store_misses_cnt();
+	st.dirty_evicts = ch.get_dirty_evicts_cnt();
+	print_latency(vector<LevelStats>(1, st), vector<LatencyConfig>(1, lat),
+		st.misses+ch.get_prefetch_counters().issued, st.dirty_evicts, cfg.block);
+}
+
+/*
+ * Prints the miss rate estimated from the samples of a cache, with its
+ * 95% confidence interval.
+ * 
+ * @param[in] st	Sampled estimate of the cache.
+ */
+void print_samples(const SampleStats &st)
+{
+	double mean = st.count ? st.sum/st.count : 0.0;
+	double ci = 0.0;
+	if (st.count > 1)
+	{
+		double var = (st.sum_sq-st.count*mean*mean)/(st.count-1);
+		ci = 1.96*sqrt(max(var, 0.0)/st.count);
+	}
+
+	printf(SEP_TABLE);
+	printf("# Sampling results:\n");
+	printf("%-30s%-10" PRIu64 "\n", "Samples:", st.count);
+	printf("%-30s%-10.4f\n", "Sampled miss rate:", mean);
+	printf("%-30s%-10.4f\n", "95% confidence (+/-):", ci);
+	printf("\n");
+}
+
+/*
+ * Prints the results of a cache hierarchy.
+ * 
+ * @param[in] cfgs	Configuration of each level.
+ * @param[in] hier	Simulated hierarchy.
+ * @param[in] lat	Costs of each level, empty to skip the memory model.
+ */
+void print_hierarchy(const vector<CacheConfig> &cfgs, CacheHierarchy &hier,
+	const vector<LatencyConfig> &lat)
+{
+	printf("\n");
+	printf(SEP_TABLE);
+	printf("# Hierarchy parameters:\n");
+	printf("%-30s%-10zu\n", "Levels:", hier.size());
+	printf("%-30s%-10s\n", "Inclusion policy:", inclusion_names[hier.get_inclusion()]);
+	printf("\n");
+
+	for (size_t k=0; k<hier.size(); k++)
+	{
+		const CacheConfig &cfg = cfgs[k];
+		const LevelStats &st = hier.get_stats(k);
+		double miss_rate = st.accesses ? (double)st.misses/st.accesses : 0.0;
 
-		/*
-		 * Searches for a block in this set, given a write request.
-		 * 
-		 * @param[in] tag Tag to search.
-		 */
-		int write_way(int tag)
+		printf(SEP_TABLE);
+		printf("# L%zu:\n", k+1);
+		printf("%-30s%-10d\n", "Cache size (KB):", cfg.size);
+		printf("%-30s%-10d\n", "Cache associativity:", cfg.ways);
+		printf("%-30s%-10d\n", "Cache block size:", cfg.block);
+		printf("%-30s%-10s\n", "Replacement policy:", policy_names[cfg.policy]);
+		printf("%-30s%-10" PRIu64 "\n", "Accesses:", st.accesses);
+		printf("%-30s%-10" PRIu64 "\n", "Misses:", st.misses);
+		printf("%-30s%-10.4f\n", "Miss rate:", miss_rate);
+		printf("%-30s%-10" PRIu64 "\n", "Writebacks received:", st.writebacks);
+		printf("%-30s%-10" PRIu64 "\n", "Dirty evictions:", st.dirty_evicts);
+		printf("%-30s%-10" PRIu64 "\n", "Back invalidations:", st.back_invalidations);
+		printf("\n");
+	}
+
+	printf(SEP_TABLE);
+	printf("# Memory traffic:\n");
+	printf("%-30s%-10" PRIu64 "\n", "Memory reads:", hier.get_memory_reads());
+	printf("%-30s%-10" PRIu64 "\n", "Memory writes:", hier.get_memory_writes());
+	printf("\n");
+
+	if (!lat.empty())
+	{
+		vector<LevelStats> levels;
+		for (size_t k=0; k<hier.size(); k++)
+			levels.push_back(hier.get_stats(k));
+		print_latency(levels, lat, hier.get_memory_reads(), hier.get_memory_writes(),
+			cfgs.back().block);
+	}
+}
+
+/*
+ * Prints the results of each core of a shared cache.
+ * 
+ * @param[in] shared	Simulated shared cache.
+ */
+void print_cores(SharedCache &shared)
+{
+	printf(SEP_TABLE);
+	printf("# Per core results:\n");
+	printf("%-30s%-10zu\n", "Cores:", shared.size());
+	printf("%-30s%-10s\n", "Interleaving:", interleave_names[shared.get_interleave()]);
+	printf("%-10s%-12s%-10s%-10s%-10s%-10s%-10s\n", "# Core", "Accesses", "Miss",
+		"Read miss", "Dirty ev", "Evicted", "Ways");
+	for (size_t c=0; c<shared.size(); c++)
+	{
+		const CacheCounters &cnt = shared.get_counters(c);
+		double miss_rate = cnt.access ?
+			(double)(cnt.read_misses+cnt.store_misses)/cnt.access : 0.0;
+		double read_miss_rate = cnt.access ? (double)cnt.read_misses/cnt.access : 0.0;
+		string ways = shared.get_partition() == PARTITION_NONE ? "-" :
+			to_string(shared.get_ways(c));
+		printf("%-10zu%-12" PRIu64 "%-10.4f%-10.4f%-10" PRIu64 "%-10" PRIu64 "%-10s\n",
+			c, cnt.access, miss_rate, read_miss_rate, cnt.dirty_evicts,
+			shared.get_interference(c), ways.c_str());
+	}
+	printf("\n");
+	if (shared.get_partition() == PARTITION_UCP)
+	{
+		printf("%-30s%-10" PRIu64 "\n", "UCP repartitions:", shared.get_repartitions());
+		printf("\n");
+	}
+}
+
+/*
+ * Prints the results of the private caches of the cores and their
+ * coherence traffic.
+ * 
+ * @param[in] priv	Configuration of the private caches.
+ * @param[in] caches	Simulated caches.
+ */
+void print_coherence(const CacheConfig &priv, CoherentCaches &caches)
+{
+	CoherenceCounters total = CoherenceCounters();
+
+	printf(SEP_TABLE);
+	printf("# Private caches:\n");
+	printf("%-30s%-10zu\n", "Cores:", caches.size());
+	printf("%-30s%-10s\n", "Coherence protocol:", coherence_names[caches.get_protocol()]);
+	printf("%-30s%-10d\n", "Cache size (KB):", priv.size);
+	printf("%-30s%-10d\n", "Cache associativity:", priv.ways);
+	printf("%-30s%-10d\n", "Cache block size:", priv.block);
+	printf("%-30s%-10s\n", "Replacement policy:", policy_names[priv.policy]);
+	printf("\n");
+	printf(SEP_TABLE);
+	printf("%-8s%-12s%-10s%-10s%-10s%-10s%-10s%-10s\n", "# Core", "Accesses", "Miss",
+		"Coh miss", "Invalid", "Upgrades", "C2C", "Downgr");
+	for (size_t c=0; c<caches.size(); c++)
+	{
+		CacheModel &ch = caches.get_private(c);
+		const CoherenceCounters &cnt = caches.get_counters(c);
+		uint64_t access = ch.get_access_cnt();
+		double miss_rate = access ?
+			(double)(ch.get_read_misses_cnt()+ch.get_store_misses_cnt())/access : 0.0;
+		printf("%-8zu%-12" PRIu64 "%-10.4f%-10" PRIu64 "%-10" PRIu64 "%-10" PRIu64
+			"%-10" PRIu64 "%-10" PRIu64 "\n", c, access, miss_rate, cnt.coherence_misses,
+			cnt.invalidations, cnt.upgrades, cnt.transfers, cnt.downgrades);
+		total.invalidations += cnt.invalidations;
+		total.upgrades += cnt.upgrades;
+		total.transfers += cnt.transfers;
+		total.downgrades += cnt.downgrades;
+		total.coherence_misses += cnt.coherence_misses;
+		total.control_msgs += cnt.control_msgs;
+		total.data_msgs += cnt.data_msgs;
+	}
+	printf("\n");
+
+	printf(SEP_TABLE);
+	printf("# Coherence results:\n");
+	printf("%-30s%-10" PRIu64 "\n", "Invalidations:", total.invalidations);
+	printf("%-30s%-10" PRIu64 "\n", "Upgrades:", total.upgrades);
+	printf("%-30s%-10" PRIu64 "\n", "Cache to cache transfers:", total.transfers);
+	printf("%-30s%-10" PRIu64 "\n", "Downgrade writebacks:", total.downgrades);
+	printf("%-30s%-10" PRIu64 "\n", "Coherence misses:", total.coherence_misses);
+	printf("%-30s%-10" PRIu64 "\n", "Control messages:", total.control_msgs);
+	printf("%-30s%-10" PRIu64 "\n", "Data messages:", total.data_msgs);
+	printf("%-30s%-10" PRIu64 "\n", "Coherence traffic (bytes):", caches.get_traffic());
+	printf("%-30s%-10" PRIu64 "\n", "Writebacks to shared level:", caches.get_writebacks());
+	printf("\n");
+}
+
+/*
+ * Opens the trace of each core of a multicore simulation, the text
+ * traces are decoded by a thread of their own.
+ * 
+ * @param[in] paths	Trace of each core, "synthetic:spec" for a
+ * 					synthetic trace.
+ * @param[in] skip	Accesses skipped at the start of each trace.
+ * @param[in] max_accesses	Accesses run of each trace, 0 for all.
+ * @param[out] traces	Traces opened.
+ * @param[out] sources	Traces of the cores, owned by traces.
+ * @returns bool	All the traces were opened.
+ */
+bool open_cores(const vector<string> &paths, uint64_t skip, uint64_t max_accesses,
+	vector<unique_ptr<AccessSource>> &traces, vector<AccessSource*> &sources)
+{
+	for (const string &path : paths)
+	{
+		AccessSource *src;
+		if (path.compare(0, 10, "synthetic:") == 0)
 		{
-			for(int k=0; k<s_size; k++)
+			SyntheticConfig synth;
+			if (!parse_synthetic(path.c_str()+10, synth) || !check_synthetic(synth))
 			{
-				if(ways[k].get_tag() == tag)
-				{
-					ways[k].set_rrpv(0); // hit then rrpv=0
-					ways[k].set_dirty_bit();
-					return 1; // hit
-				}
+				fprintf(stderr, "invalid synthetic trace %s\n", path.c_str()+10);
+				return false;
 			}
-			return 0; // miss
+			src = open_synthetic(synth);
 		}
-
-		/*
-		 * Removes a cache line in this set, given a write request.
-		 * 
-		 * @param[in] tag New tag to set.
-		 * @returns int Returns 1 if there is a dirty eviction,
-		 * 						0 otherwise.
-		 */
-		int write_evict_way(int tag)
+		else
 		{
-		while(1)
+			src = open_accesses(path.c_str());
+		}
+		if (src == nullptr)
 		{
-			for(int k=0; k<s_size; k++)
-			{
-				if(ways[k].get_rrpv() == max_rrpv)
-				{
-					// hit then rrpv=max-1
-					ways[k].set_rrpv(max_rrpv-1); 
-					// new tag
-					ways[k].set_tag(tag); 
-					if (ways[k].get_dirty_bit() == 1)
-					{
-						return 1;
-					}
-					else
-					{
-						// modified value
-						ways[k].set_dirty_bit();
-						return 0;
-					}
-				}
-			}
-			// increment al RRPV values
-			inc_all_rrpv();
-			}
+			fprintf(stderr, "can't open trace %s\n", path.c_str());
+			return false;
 		}
+		if (skip > 0 || max_accesses > 0)
+			src = new TraceWindow(src, skip, max_accesses);
+		traces.emplace_back(src);
+		sources.push_back(src);
+	}
+	return true;
+}
 
-		/*
-		 * Increments al RRPV values of the current cache set.
-		 */
-		void inc_all_rrpv()
+/*
+ * Runs a cache shared by several cores and prints its results, each
+ * core reads its own trace.
+ * 
+ * @param[in] paths	Trace of each core, "synthetic:spec" for a
+ * 					synthetic trace.
+ * @param[in] cfg	Configuration of the shared cache.
+ * @param[in] interleave	InterleaveKind of the accesses.
+ * @param[in] partition	PartitionKind of the ways.
+ * @param[in] ways	Ways of each core of a fixed partition.
+ * @param[in] period	Accesses between repartitions of UCP.
+ * @param[in] skip	Accesses skipped at the start of each trace.
+ * @param[in] max_accesses	Accesses run of each trace, 0 for all.
+ * @param[in] warmup	Accesses run before counting.
+ * @param[in] lat	Costs of the cache, empty to skip the memory model.
+ * @returns int	Exit status of the program.
+ */
+int run_shared(const vector<string> &paths, const CacheConfig &cfg, int interleave,
+	int partition, const vector<int> &ways, uint64_t period, uint64_t skip,
+	uint64_t max_accesses, uint64_t warmup, const vector<LatencyConfig> &lat)
+{
+	int cores = paths.size();
+	if (!valid_config(cfg))
+		return 1;
+	if (cfg.ways > 64 && partition != PARTITION_NONE)
+	{
+		fprintf(stderr, "partitions need up to 64 ways\n");
+		return 1;
+	}
+	if (partition == PARTITION_WAYS)
+	{
+		int total = 0;
+		for (int w : ways)
+			total += w;
+		if ((int)ways.size() != cores || total > cfg.ways)
 		{
-			for(int k=0; k<s_size; k++)
-			{
-				int old_rrpv = ways[k].get_rrpv();
-				ways[k].set_rrpv(old_rrpv+1);
-			}
+			fprintf(stderr, "the partition needs the ways of each core, up to %d\n", cfg.ways);
+			return 1;
 		}
-};
-
-	// hash map with the cache sets
-	unordered_map<int,Set> map_sets;
-
-	/*
-	 * Inits cache values.
-	 * @param[in] s	Size of the cache in KB.
-	 * @param[in] w	Numer of ways of the cache.
-	 * @param[in] b	Block size of the cache.
-	 */
-	CacheSRRIP(int s,int w,int b)
-	{
-		cache_s = s;	// cache size in KB
-		cache_w = w;	// associativity
-		cache_b = b;	// block size in bytes
-		access_cnt=0;	// inits access counter
-		read_hit_cnt = 0;	// inits read hit counter
-		store_hit_cnt = 0;	// inits store hit counter
-		read_misses_cnt = 0;	// inits read misses counter
-		store_misses_cnt = 0;	// inits store misses counter
-		dirty_evicts_cnt = 0;	// inits dirty eviction counter
-		
-		// definition of M SRRIP param
-		if(cache_w>2)
-			srrip_m = 2;
-		else
-			srrip_m = 1;
+	}
+	if (partition == PARTITION_UCP && cores > cfg.ways)
+	{
+		fprintf(stderr, "ucp needs a way for each core\n");
+		return 1;
+	}
 
-		// calculate index offset
-		index_offset = (int)round(log2(cache_b));
+	vector<unique_ptr<AccessSource>> traces;
+	vector<AccessSource*> sources;
+	if (!open_cores(paths, skip, max_accesses, traces, sources))
+		return 1;
 
-		// calculate tag offset
-		tag_offset = index_offset + (int)(log2(cache_s*pow(2,10)/(cache_w*cache_b)));
-	}
+	auto start = high_resolution_clock::now();
 
+	SharedCache shared(cfg, cores, interleave);
+	if (partition == PARTITION_WAYS)
+		shared.set_partition(ways);
+	else if (partition == PARTITION_UCP)
+		shared.set_ucp(period);
+	shared.set_warmup(warmup);
+	shared.run(sources);
 
-	/*
-	 * Retuns the M value of the SRRIP cache.
-	 * 
-	 * @returns int M value for SRRIP.
-	 */
-	int get_srrip_m()
+	auto stop = high_resolution_clock::now();
+	auto duration = duration_cast<milliseconds>(stop-start).count();
+
+	print_results(cfg, shared.get_cache());
+	if (!lat.empty())
 	{
-	return srrip_m;
+		print_latency(cfg, shared.get_cache(), lat[0]);
 	}
+	print_cores(shared);
 
-	/*
-	 * Process a load request.
-	 * 
-	 * @param input_index	Index bits.
-	 * @param input_tag	Tag bits.
-	 */
-	void load(int input_index, int tag)
+	printf(SEP_TABLE);
+	printf("%-30s%-10ld\n", "Simulation time (ms):", duration);
+	printf("\n");
+
+	return 0;
+}
+
+/*
+ * Runs the coherent private caches of several cores over a shared
+ * level and prints their results, each core reads its own trace.
+ * 
+ * @param[in] paths	Trace of each core, "synthetic:spec" for a
+ * 					synthetic trace.
+ * @param[in] priv	Configuration of the private caches.
+ * @param[in] cfg	Configuration of the shared level.
+ * @param[in] coherence	CoherenceKind of the private caches.
+ * @param[in] interleave	InterleaveKind of the accesses.
+ * @param[in] skip	Accesses skipped at the start of each trace.
+ * @param[in] max_accesses	Accesses run of each trace, 0 for all.
+ * @param[in] warmup	Accesses run before counting.
+ * @returns int	Exit status of the program.
+ */
+int run_coherent(const vector<string> &paths, const CacheConfig &priv,
+	const CacheConfig &cfg, int coherence, int interleave, uint64_t skip,
+	uint64_t max_accesses, uint64_t warmup)
+{
+	if (!valid_config(priv) || !valid_config(cfg))
+		return 1;
+	if (paths.size() > 64)
 	{
-		if (map_sets.at(input_index).read_way(tag))
-		{
-			// hit
-			// inc hit counter
-			read_hit_cnt++;
-		}
-		else
+		fprintf(stderr, "coherence supports up to 64 cores\n");
+		return 1;
+	}
+	if (cfg.block < priv.block)
+	{
+		fprintf(stderr, "the block size can't decrease down the hierarchy\n");
+		return 1;
+	}
+
+	vector<unique_ptr<AccessSource>> traces;
+	vector<AccessSource*> sources;
+	if (!open_cores(paths, skip, max_accesses, traces, sources))
+		return 1;
+
+	auto start = high_resolution_clock::now();
+
+	CoherentCaches caches(priv, cfg, paths.size(), coherence, interleave);
+	caches.set_warmup(warmup);
+	caches.run(sources);
+
+	auto stop = high_resolution_clock::now();
+	auto duration = duration_cast<milliseconds>(stop-start).count();
+
+	print_results(cfg, caches.get_shared());
+	print_coherence(priv, caches);
+
+	printf(SEP_TABLE);
+	printf("%-30s%-10ld\n", "Simulation time (ms):", duration);
+	printf("\n");
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	vector<int> cache_sizes;
+	vector<int> cache_ways;
+	vector<int> cache_block_sizes;
+	vector<int> cache_policies(1, POLICY_SRRIP);
+	vector<CacheConfig> configs;
+	vector<CacheConfig> hier_levels;
+	vector<LatencyConfig> latencies;
+	int inclusion = INCLUSION_NINE;
+	const char *trace_path = "-";
+	bool synthetic = false;
+	SyntheticConfig synth;
+	const char *convert_path = nullptr;
+	bool convert_delta = false;
+	int threads = 1;
+	int shards = 1;
+	uint64_t interval = 0;
+	uint64_t warmup = 0;
+	uint64_t max_accesses = 0;
+	uint64_t skip = 0;
+	uint64_t sample_period = 0;
+	uint64_t sample_warmup = 0;
+	uint64_t sample_detail = 0;
+	const char *checkpoint_path = nullptr;
+	const char *restore_path = nullptr;
+	FILE *restore_file = nullptr;
+	uint64_t offset = 0;
+	bool profile = false;
+	int hot = 0;
+	int prefetch = PREFETCH_NONE;
+	int prefetch_degree = 0;
+	const char *interval_path = nullptr;
+	bool interval_json = false;
+	vector<string> core_paths;
+	int interleave = INTERLEAVE_RR;
+	int partition = PARTITION_NONE;
+	vector<int> partition_ways;
+	uint64_t ucp_period = UCP_PERIOD;
+	int coherence = -1;
+	CacheConfig private_cfg = CacheConfig();
+	bool has_private = false;
+	enum { OPT_CONVERT = 256, OPT_DELTA, OPT_LEVEL, OPT_INCLUSION,
+		OPT_INTERVAL_OUT, OPT_INTERVAL_FORMAT, OPT_WARMUP, OPT_MAX_ACCESSES,
+		OPT_SKIP, OPT_SAMPLE, OPT_CHECKPOINT, OPT_RESTORE, OPT_PROFILE, OPT_HOT,
+		OPT_PREFETCH, OPT_LATENCY, OPT_SYNTHETIC, OPT_DENSE_MAX, OPT_CORE,
+		OPT_INTERLEAVE, OPT_PARTITION, OPT_COHERENCE, OPT_PRIVATE };
+	static struct option long_opts[] = {
+		{"convert", required_argument, nullptr, OPT_CONVERT},
+		{"delta", no_argument, nullptr, OPT_DELTA},
+		{"level", required_argument, nullptr, OPT_LEVEL},
+		{"inclusion", required_argument, nullptr, OPT_INCLUSION},
+		{"interval-out", required_argument, nullptr, OPT_INTERVAL_OUT},
+		{"interval-format", required_argument, nullptr, OPT_INTERVAL_FORMAT},
+		{"warmup", required_argument, nullptr, OPT_WARMUP},
+		{"max-accesses", required_argument, nullptr, OPT_MAX_ACCESSES},
+		{"skip", required_argument, nullptr, OPT_SKIP},
+		{"sample", required_argument, nullptr, OPT_SAMPLE},
+		{"checkpoint", required_argument, nullptr, OPT_CHECKPOINT},
+		{"restore", required_argument, nullptr, OPT_RESTORE},
+		{"profile", no_argument, nullptr, OPT_PROFILE},
+		{"hot", required_argument, nullptr, OPT_HOT},
+		{"prefetch", required_argument, nullptr, OPT_PREFETCH},
+		{"latency", required_argument, nullptr, OPT_LATENCY},
+		{"synthetic", required_argument, nullptr, OPT_SYNTHETIC},
+		{"dense-max", required_argument, nullptr, OPT_DENSE_MAX},
+		{"core", required_argument, nullptr, OPT_CORE},
+		{"interleave", required_argument, nullptr, OPT_INTERLEAVE},
+		{"partition", required_argument, nullptr, OPT_PARTITION},
+		{"coherence", required_argument, nullptr, OPT_COHERENCE},
+		{"private", required_argument, nullptr, OPT_PRIVATE},
+		{nullptr, 0, nullptr, 0}
+	};
+	int c;
+	// reads options from command line, -t, -a, -l and -p take a comma
+	// separated list of values and all their combinations are simulated
+	while ((c = getopt_long (argc, argv, "t:a:l:p:f:s:j:S:i:", long_opts, nullptr)) != -1)
+		switch (c)
 		{
-			// miss
-			// inc miss counter
-			read_misses_cnt++;
-			// check for dirty eviction
-			if (map_sets.at(input_index).read_evict_way(tag))
+			case 't':
+				cache_sizes = parse_list(optarg);
+				break;
+			case 'a':
+				cache_ways = parse_list(optarg);
+				break;
+			case 'l':
+				cache_block_sizes = parse_list(optarg);
+				break;
+			case 'p':
+				cache_policies = parse_policies(optarg);
+				break;
+			case 'f':
+				trace_path = optarg;
+				break;
+			case 's':
+				if (!read_configs(optarg, configs))
+				{
+					fprintf(stderr, "can't read configurations %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'j':
+				threads = stoi(optarg);
+				break;
+			case 'S':
+				shards = stoi(optarg);
+				break;
+			case 'i':
+				interval = strtoull(optarg, nullptr, 10);
+				break;
+			case OPT_INTERVAL_OUT:
+				interval_path = optarg;
+				break;
+			case OPT_INTERVAL_FORMAT:
+				if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0)
+				{
+					fprintf(stderr, "unknown interval format %s\n", optarg);
+					return 1;
+				}
+				interval_json = strcmp(optarg, "json") == 0;
+				break;
+			case OPT_WARMUP:
+				warmup = strtoull(optarg, nullptr, 10);
+				break;
+			case OPT_MAX_ACCESSES:
+				max_accesses = strtoull(optarg, nullptr, 10);
+				break;
+			case OPT_SKIP:
+				skip = strtoull(optarg, nullptr, 10);
+				break;
+			case OPT_CHECKPOINT:
+				checkpoint_path = optarg;
+				break;
+			case OPT_RESTORE:
+				restore_path = optarg;
+				break;
+			case OPT_PROFILE:
+				profile = true;
+				break;
+			case OPT_LATENCY:
 			{
-				dirty_evicts_cnt++;
+				LatencyConfig lat;
+				if (!parse_latency(optarg, lat))
+				{
+					fprintf(stderr, "invalid latencies %s\n", optarg);
+					return 1;
+				}
+				latencies.push_back(lat);
+				break;
 			}
+			case OPT_SYNTHETIC:
+				if (!parse_synthetic(optarg, synth) || !check_synthetic(synth))
+				{
+					fprintf(stderr, "invalid synthetic trace %s\n", optarg);
+					return 1;
+				}
+				synthetic = true;
+				break;
+			case OPT_DENSE_MAX:
+				set_dense_limit(strtoull(optarg, nullptr, 10)<<20);
+				break;
+			case OPT_CORE:
+				core_paths.push_back(optarg);
+				break;
+			case OPT_INTERLEAVE:
+				if (strcmp(optarg, "rr") != 0 && strcmp(optarg, "time") != 0)
+				{
+					fprintf(stderr, "unknown interleaving %s\n", optarg);
+					return 1;
+				}
+				interleave = strcmp(optarg, "rr") == 0 ? INTERLEAVE_RR : INTERLEAVE_TIME;
+				break;
+			case OPT_COHERENCE:
+				if (strcmp(optarg, "mesi") != 0 && strcmp(optarg, "moesi") != 0)
+				{
+					fprintf(stderr, "unknown coherence protocol %s\n", optarg);
+					return 1;
+				}
+				coherence = strcmp(optarg, "mesi") == 0 ? COHERENCE_MESI : COHERENCE_MOESI;
+				break;
+			case OPT_PRIVATE:
+				if (!parse_level(optarg, private_cfg))
+				{
+					fprintf(stderr, "invalid private cache %s\n", optarg);
+					return 1;
+				}
+				has_private = true;
+				break;
+			case OPT_PARTITION:
+				if (!parse_partition(optarg, partition, partition_ways, ucp_period))
+				{
+					fprintf(stderr, "invalid partition %s\n", optarg);
+					return 1;
+				}
+				break;
+			case OPT_PREFETCH:
+				if (!parse_prefetch(optarg, prefetch, prefetch_degree))
+				{
+					fprintf(stderr, "unknown prefetcher %s\n", optarg);
+					return 1;
+				}
+				break;
+			case OPT_HOT:
+#ifndef CACHE_STATS
+				fprintf(stderr, "--hot needs the instrumented build, make cache_stats\n");
+				return 1;
+#endif
+				hot = stoi(optarg);
+				break;
+			case OPT_SAMPLE:
+				if (sscanf(optarg, "%" SCNu64 ",%" SCNu64 ",%" SCNu64, &sample_period,
+					&sample_warmup, &sample_detail) != 3 || sample_detail == 0 ||
+					sample_period < sample_warmup+sample_detail)
+				{
+					fprintf(stderr, "invalid sampling %s\n", optarg);
+					return 1;
+				}
+				break;
+			case OPT_CONVERT:
+				convert_path = optarg;
+				break;
+			case OPT_DELTA:
+				convert_delta = true;
+				break;
+			case OPT_LEVEL:
+			{
+				CacheConfig cfg;
+				if (!parse_level(optarg, cfg))
+				{
+					fprintf(stderr, "invalid cache level %s\n", optarg);
+					return 1;
+				}
+				hier_levels.push_back(cfg);
+				break;
+			}
+			case OPT_INCLUSION:
+				inclusion = parse_inclusion(optarg);
+				if (inclusion < 0)
+				{
+					fprintf(stderr, "unknown inclusion policy %s\n", optarg);
+					return 1;
+				}
+				break;
 		}
-	}	
 
-	/*
-	 * Process a store request.
-	 * 
-	 * @param input_index	Index bits.
-	 * @param input_tag	Tag bits.
-	 */
-	void store(int input_index, int tag)
+	// grid of configurations from the command line
+	for (int s : cache_sizes)
+		for (int w : cache_ways)
+			for (int b : cache_block_sizes)
+				for (int p : cache_policies)
+					configs.push_back({s, w, b, p});
+
+	// the cores of a shared cache read a trace each
+	if (!core_paths.empty())
 	{
-		if (map_sets.at(input_index).write_way(tag))
+		if (configs.size() != 1 || synthetic || strcmp(trace_path, "-") != 0 ||
+			shards > 1 || !hier_levels.empty() || interval > 0 || sample_detail > 0 ||
+			prefetch != PREFETCH_NONE || profile || hot > 0 || checkpoint_path != nullptr ||
+			restore_path != nullptr || convert_path != nullptr || latencies.size() > 1)
 		{
-			// hit
-			// inc hit counter
-			store_hit_cnt++;
+			fprintf(stderr, "--core needs a single cache configuration, without -f, --synthetic, -S, --level, -i, --sample, --prefetch, --profile, --hot, --convert or checkpoints\n");
+			return 1;
 		}
-		else
+		if (has_private != (coherence >= 0))
 		{
-			// miss
-			// inc miss counter
-			store_misses_cnt++;
-			if (map_sets.at(input_index).write_evict_way(tag))
-			{
-				// inc dirty
-				dirty_evicts_cnt++;
-			}
+			fprintf(stderr, "--coherence and --private go together\n");
+			return 1;
 		}
-	}
-
-	/*
-	 * Processes a write/load request.
-	 * 
-	 * @param[in] ls Indicates type of request(1:store/0:load).
-	 * @param[in] phy_addr Physical address to write/read.
-	 */
-	void run(int ls, int phy_addr)
-	{
-		access_cnt++;
-		int input_index = 0;
-		int input_tag = 0;
-		
-		// extract index
-		input_index = bit_crop(phy_addr, tag_offset, index_offset);
-		// extract tag
-		input_tag = bit_crop(phy_addr, 32, tag_offset);
-		
-		// check for set existence
-		if(map_sets.find(input_index) == map_sets.end())
+		if (has_private && (partition != PARTITION_NONE || !latencies.empty()))
 		{
-			// create set for that index
-			map_sets.insert(make_pair(input_index, Set(cache_w,srrip_m)));
+			fprintf(stderr, "--coherence can't be used with --partition or --latency\n");
+			return 1;
 		}
-		
-		if (ls == 0)
+		if (has_private)
 		{
-			// load value
-			load(input_index, input_tag);
+			return run_coherent(core_paths, private_cfg, configs[0], coherence, interleave,
+				skip, max_accesses, warmup);
 		}
-		else
+		return run_shared(core_paths, configs[0], interleave, partition, partition_ways,
+			ucp_period, skip, max_accesses, warmup, latencies);
+	}
+	if (partition != PARTITION_NONE || has_private || coherence >= 0)
+	{
+		fprintf(stderr, "--partition, --coherence and --private need --core\n");
+		return 1;
+	}
+
+	// a restored run takes the caches from the checkpoint and goes on
+	// from the same access of the trace
+	if (restore_path != nullptr)
+	{
+		if (!configs.empty())
 		{
-			// write value
-			store(input_index,input_tag);
+			fprintf(stderr, "--restore takes the configurations from the checkpoint\n");
+			return 1;
 		}
+		restore_file = open_checkpoint(restore_path, configs, offset);
+		if (restore_file == nullptr)
+		{
+			fprintf(stderr, "can't read checkpoint %s\n", restore_path);
+			return 1;
+		}
+		skip += offset;
 	}
 
-	/*
-	 * Returns access counter.
-	 * 
-	 * @returns int Access counter.
-	 */
-	int get_access_cnt()
+	if (synthetic && strcmp(trace_path, "-") != 0)
 	{
-		return access_cnt;
+		fprintf(stderr, "--synthetic can't be used with -f\n");
+		return 1;
 	}
-
-	/*
-	 * Returns read hit counter.
-	 * 
-	 * @returns int Read hit counter.
-	 */
-	int get_read_hit_cnt()
+	unique_ptr<AccessSource> trace(synthetic ? open_synthetic(synth) : open_accesses(trace_path));
+	if (!trace)
 	{
-		return read_hit_cnt;
+		fprintf(stderr, "can't open trace %s\n", trace_path);
+		return 1;
 	}
-
-	/*
-	 * Returns the store hit counter.
-	 * 
-	 * @returns int Store hit counter.
-	 */
-	int get_store_hit_cnt()
+	if (skip > 0 || max_accesses > 0)
 	{
-		return store_hit_cnt;
+		trace.reset(new TraceWindow(trace.release(), skip, max_accesses));
+	}
+	if (sample_detail > 0 && convert_path == nullptr)
+	{
+		trace.reset(new TraceSampler(trace.release(), sample_period,
+			sample_warmup+sample_detail));
 	}
 
-	/*
-	 * Returns the misses counter.
-	 * 
-	 * @returns int Misses counter.
-	 */
-	int get_read_misses_cnt()
+	// only converts the trace to binary
+	if (convert_path != nullptr)
 	{
-		return read_misses_cnt;
+		return convert_trace(trace.get(), convert_path, convert_delta);
 	}
 
-	/*
-	 * Returns the store misses counter.
-	 * 
-	 * @returns int Stores misses counter.
-	 */
-	int get_store_misses_cnt()
+	for (const CacheConfig &cfg : configs)
 	{
-		return store_misses_cnt;
+		if (!valid_config(cfg))
+			return 1;
 	}
-	
-	/*
-	 * Returns the dirty evictions counter.
-	 * 
-	 * @returns int Dirty evictions counter.
-	 */
-	int get_dirty_evicts_cnt()
+	for (size_t k=0; k<hier_levels.size(); k++)
 	{
-		return dirty_evicts_cnt;
+		if (!valid_config(hier_levels[k]))
+			return 1;
+		// a line of a level must cover whole lines of the levels above
+		if (k > 0 && hier_levels[k].block < hier_levels[k-1].block)
+		{
+			fprintf(stderr, "the block size can't decrease down the hierarchy\n");
+			return 1;
+		}
+		if (k > 0 && inclusion == INCLUSION_EXCLUSIVE &&
+			hier_levels[k].block != hier_levels[k-1].block)
+		{
+			fprintf(stderr, "exclusive levels need the same block size\n");
+			return 1;
+		}
+	}
+	if (!hier_levels.empty() && (!configs.empty() || shards > 1))
+	{
+		fprintf(stderr, "--level can't be used with other configurations or -S\n");
+		return 1;
+	}
+	if (hier_levels.empty() ? latencies.size() > 1 :
+		!latencies.empty() && latencies.size() != hier_levels.size())
+	{
+		fprintf(stderr, "--latency is given once, or once per --level\n");
+		return 1;
+	}
+	if (!hier_levels.empty() && interval > 0)
+	{
+		fprintf(stderr, "-i can't be used with --level\n");
+		return 1;
+	}
+	if (sample_detail > 0 && (!hier_levels.empty() || shards > 1 ||
+		interval > 0 || warmup > 0))
+	{
+		fprintf(stderr, "--sample can't be used with --level, -S, -i or --warmup\n");
+		return 1;
+	}
+	if (hot > 0 && (!hier_levels.empty() || shards > 1))
+	{
+		fprintf(stderr, "--hot can't be used with --level or -S\n");
+		return 1;
+	}
+	if (prefetch != PREFETCH_NONE && (!hier_levels.empty() || shards > 1 ||
+		sample_detail > 0 || checkpoint_path != nullptr || restore_path != nullptr ||
+		hot > 0 || profile))
+	{
+		fprintf(stderr, "--prefetch can't be used with --level, -S, --sample, --hot, --profile or checkpoints\n");
+		return 1;
+	}
+	if (profile && (!hier_levels.empty() || shards > 1 || sample_detail > 0 ||
+		checkpoint_path != nullptr || restore_path != nullptr || interval > 0))
+	{
+		fprintf(stderr, "--profile can't be used with --level, -S, -i, --sample or checkpoints\n");
+		return 1;
+	}
+	if (profile)
+	{
+		// profiles always model LRU caches
+		profile_trace(trace.get(), configs);
+		return 0;
+	}
+	if ((checkpoint_path != nullptr || restore_path != nullptr) &&
+		(!hier_levels.empty() || shards > 1 || sample_detail > 0))
+	{
+		fprintf(stderr, "checkpoints can't be used with --level, -S or --sample\n");
+		return 1;
 	}
-};
-
 
-int main(int argc, char** argv)
-{
-	int cache_size = 0;
-	int cache_ways = 0;
-	int cache_block_size = 0;
-	char c;
-	// reads options from command line (all are required)
-	while ((c = getopt (argc, argv, "t:a:l:")) != -1)
-		switch (c)
+	// snapshots go to their own stream, stderr by default
+	FILE *interval_out = stderr;
+	if (interval > 0 && interval_path != nullptr)
+	{
+		interval_out = fopen(interval_path, "w");
+		if (interval_out == nullptr)
 		{
-			case 't':
-				cache_size = stoi(optarg);
-				break;
-			case 'a':
-				cache_ways = stoi(optarg);
-				break;
-			case 'l':
-				cache_block_size = stoi(optarg);
-				break;
+			fprintf(stderr, "can't open %s\n", interval_path);
+			return 1;
 		}
+	}
+
+	if (shards > 1 && configs.size() != 1)
+	{
+		fprintf(stderr, "-S needs a single cache configuration\n");
+		return 1;
+	}
+	if (shards > 1 && configs[0].policy == POLICY_DRRIP)
+	{
+		// PSEL is shared by all the sets
+		fprintf(stderr, "-S doesn't support drrip\n");
+		return 1;
+	}
 
 	// start simulation timer
 	auto start = high_resolution_clock::now();
 
-	double miss_rate = 0.0;
-	double read_miss_rate = 0.0;
-	int dirty_evictions_cnt = 0;
-	int load_misses_cnt = 0;
-	int store_misses_cnt = 0;
-	int total_misses_cnt = 0;
-	int load_hits_cnt = 0;
-	int store_hits_cnt = 0;
-	int total_hits_cnt = 0;
-	int access_cnt = 0;
-	
-	int ls;
-	int phy_addr;
-	
-	// create cache instance
-	CacheSRRIP ch(cache_size, cache_ways, cache_block_size);
-	for (string line; getline(cin, line);)
+	unique_ptr<ShardedCache> sharded;
+	unique_ptr<Sweep> sweep;
+	unique_ptr<CacheHierarchy> hierarchy;
+	unique_ptr<IntervalLog> log;
+	if (!hier_levels.empty())
 	{
-		// process trace line
-		ls = (int)line[2]-48;
-		phy_addr = stoi(line.substr(4,12), nullptr, 16);
-		ch.run(ls, phy_addr);
+		// run the levels of the hierarchy together
+		hierarchy.reset(new CacheHierarchy(hier_levels, inclusion));
+		hierarchy->set_warmup(warmup);
+		hierarchy->run(trace.get());
+	}
+	else if (shards > 1)
+	{
+		// split the sets of the cache between threads
+		sharded.reset(new ShardedCache(configs[0], shards));
+		sharded->set_warmup(warmup);
+		if (interval > 0)
+		{
+			int n = sharded->size();
+			log.reset(new IntervalLog(configs, n, n, interval, interval_out, interval_json));
+		}
+		sharded->run(trace.get(), log.get());
+	}
+	else
+	{
+		// create cache instances and run the trace once for all of them
+		sweep.reset(new Sweep(configs));
+		if (restore_file != nullptr && !load_checkpoint(restore_file, *sweep))
+		{
+			fprintf(stderr, "invalid checkpoint %s\n", restore_path);
+			return 1;
+		}
+		sweep->set_warmup(warmup);
+		if (prefetch != PREFETCH_NONE)
+		{
+			sweep->set_prefetch(prefetch, prefetch_degree);
+		}
+		if (sample_detail > 0)
+		{
+			sweep->set_sampling(sample_warmup, sample_detail);
+		}
+		if (interval > 0)
+		{
+			log.reset(new IntervalLog(configs, max(threads, 1), 1, interval,
+				interval_out, interval_json));
+		}
+		sweep->run(trace.get(), threads, log.get());
+	}
+	if (log)
+	{
+		log->finish();
+		if (interval_out != stderr)
+			fclose(interval_out);
 	}
 	
-	store_hits_cnt = ch.get_store_hit_cnt();
-	load_hits_cnt = ch.get_read_hit_cnt();
-	store_misses_cnt = ch.get_store_misses_cnt();
-	load_misses_cnt = ch.get_read_misses_cnt();
-	dirty_evictions_cnt = ch.get_dirty_evicts_cnt();
-	access_cnt = ch.get_access_cnt();
-	total_hits_cnt = load_hits_cnt + store_hits_cnt;
-	total_misses_cnt = load_misses_cnt + store_misses_cnt;
-	
-	// calculate params
-	miss_rate = ((double)load_misses_cnt + store_misses_cnt)/access_cnt;
-	read_miss_rate = (double)load_misses_cnt/access_cnt;
-	
+	// the checkpoint continues the trace after the last access run
+	if (checkpoint_path != nullptr &&
+		!save_checkpoint(checkpoint_path, *sweep, skip+sweep->get_consumed()))
+	{
+		fprintf(stderr, "can't write checkpoint %s\n", checkpoint_path);
+		return 1;
+	}
+
 	// stop simulation timer
 	auto stop = high_resolution_clock::now(); 
 
 	auto duration = duration_cast<milliseconds>(stop-start).count();
 
-	// print simulation params
-	printf("\n");
-	printf(SEP_TABLE);
-	printf("# Cache parameters:\n");
-	printf("%-30s%-10d\n", "Cache size (KB):", cache_size);
-	printf("%-30s%-10d\n", "Cache associativity:", cache_ways);
-	printf("%-30s%-10d\n", "Cache block size:", cache_block_size);
-	printf("\n");
-
-	// print simulation results
-	printf(SEP_TABLE);
-	printf("# Simulation results:\n");
-	printf("%-30s%-10.4f\n", "Overall miss rate:", miss_rate);
-	printf("%-30s%-10.4f\n", "Read miss rate:", read_miss_rate);
-	printf("%-30s%-10d\n", "Dirty evictions:", dirty_evictions_cnt);
-	printf("%-30s%-10d\n", "Load misses:", load_misses_cnt);
-	printf("%-30s%-10d\n", "Store misses:", store_misses_cnt);
-	printf("%-30s%-10d\n", "Total misses:", total_misses_cnt);
-	printf("%-30s%-10d\n", "Loads hits:", load_hits_cnt);
-	printf("%-30s%-10d\n", "Store hits:", store_hits_cnt);
-	printf("%-30s%-10d\n", "Total hits:", total_hits_cnt);
-	printf("\n");
+	if (hierarchy)
+	{
+		print_hierarchy(hier_levels, *hierarchy, latencies);
+	}
+	else if (sharded)
+	{
+		print_results(configs[0], sharded->get_cache());
+		if (!latencies.empty())
+		{
+			print_latency(configs[0], sharded->get_cache(), latencies[0]);
+		}
+	}
+	else
+	{
+		for (size_t k=0; k<sweep->size(); k++)
+		{
+			print_results(sweep->get_config(k), sweep->get_cache(k));
+			if (!latencies.empty())
+			{
+				print_latency(sweep->get_config(k), sweep->get_cache(k), latencies[0]);
+			}
+			if (sample_detail > 0)
+			{
+				print_samples(sweep->get_samples(k));
+			}
+#ifdef CACHE_STATS
+			if (hot > 0)
+			{
+				sweep->get_cache(k).print_hot(stdout, hot);
+			}
+#endif
+		}
+	}
 
 	// print simulation execution data
 	printf(SEP_TABLE);
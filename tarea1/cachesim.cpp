@@ -0,0 +1,3504 @@
+/*
+ * file: cachesim.cpp
+ * 
+ * Implementation of the cache model of cachesim.h: the kernels of the
+ * replacement state, the replacement policies, the Cache template and
+ * the factory of the specialized caches, the prefetchers, the readers
+ * of the text and binary traces and the checkpoints.
+ */
+
+// separation line of the tables of print_hot
+#define SEP_TABLE "#########################################\n"
+
+// leader sets of each policy and max PSEL value of DRRIP
+#define DRRIP_LEADERS 32
+#define DRRIP_PSEL_MAX 1023
+
+// default max bytes of the lines of a cache allocated up front, bigger
+// caches create their sets on demand in a SetTable
+#define DENSE_MAX_BYTES (1ULL<<28)
+
+// bytes of a line in a LineStore, its tag and replacement state, the
+// dirty bit rounded up
+#define LINE_STORE_BYTES 9
+
+// min bytes of an ArenaArray backed by transparent huge pages
+#define ARENA_HUGE_PAGE_MIN (1<<21)
+
+// initial buckets of a SetTable, it doubles when half of them are used
+#define SET_TABLE_MIN_BUCKETS 1024
+
+// size of the input buffer of the trace reader in bytes
+#define TRACE_BUF_SIZE (1<<20)
+
+// instruction of the accesses of the synthetic traces
+#define SYNTH_PC 0x400000
+
+// magic and version of the binary trace format
+#define BIN_TRACE_MAGIC "SRRIPTRC"
+#define BIN_TRACE_VERSION 2
+// flag of binary traces with delta encoded records
+#define BIN_TRACE_DELTA 1
+// flag of delta traces with the instruction of each access
+#define BIN_TRACE_PC 2
+// escape of delta records, the absolute address follows in two words
+#define BIN_DELTA_ESCAPE 0x7FFFFFFF
+// escape of the instruction words of delta records
+#define BIN_PC_ESCAPE 0xFFFFFFFF
+
+// magic and version of the checkpoint format
+#define CHECKPOINT_MAGIC "SRRIPCKP"
+#define CHECKPOINT_VERSION 3
+// words converted at once by the writes of checkpoints
+#define CHECKPOINT_CHUNK 512
+
+// requests of a batch split at once, and requests ahead of the current
+// one whose set is prefetched
+#define RUN_CHUNK 256
+#define SET_PREFETCH_DISTANCE 8
+// bytes of tags from which the sets are prefetched, smaller caches stay
+// in the host caches
+#define SET_PREFETCH_MIN_BYTES (1<<23)
+
+// entries of the table of the stride prefetcher (power of 2)
+#define STRIDE_TABLE_SIZE 256
+// streams of the stream prefetcher and lines from the last access of a
+// stream that continue it
+#define STREAM_COUNT 16
+#define STREAM_WINDOW 16
+
+#include "cachesim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace cachesim
+{
+
+/*
+ * Returns the highest RRPV value of a set.
+ * 
+ * @param[in] rrpv	RRPV values of the ways of the set.
+ * @param[in] n	Number of ways.
+ * @return int	Highest RRPV value.
+ */
+static inline int max_rrpv_of(const uint8_t *rrpv, int n)
+{
+	int k = 0;
+	int m = 0;
+#if defined(__AVX2__)
+	if (n >= 32)
+	{
+		__m256i vmax = _mm256_setzero_si256();
+		for (; k+32 <= n; k += 32)
+			vmax = _mm256_max_epu8(vmax, _mm256_loadu_si256((const __m256i*)(rrpv+k)));
+		__m128i v = _mm_max_epu8(_mm256_castsi256_si128(vmax), _mm256_extracti128_si256(vmax, 1));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+		m = _mm_cvtsi128_si32(v) & 0xFF;
+	}
+#endif
+#if defined(__SSE2__)
+	if (n-k >= 8)
+	{
+		__m128i v = _mm_setzero_si128();
+		for (; k+16 <= n; k += 16)
+			v = _mm_max_epu8(v, _mm_loadu_si128((const __m128i*)(rrpv+k)));
+		if (k+8 <= n)
+		{
+			// upper half is zero filled
+			v = _mm_max_epu8(v, _mm_loadl_epi64((const __m128i*)(rrpv+k)));
+			k += 8;
+		}
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+		v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+		int vm = _mm_cvtsi128_si32(v) & 0xFF;
+		if (vm > m)
+			m = vm;
+	}
+#elif defined(USE_NEON)
+	for (; k+16 <= n; k += 16)
+	{
+		int vm = vmaxvq_u8(vld1q_u8(rrpv+k));
+		if (vm > m)
+			m = vm;
+	}
+#endif
+	for (; k < n; k++)
+	{
+		if (rrpv[k] > m)
+			m = rrpv[k];
+	}
+	return m;
+}
+
+/*
+ * Returns the first way of a set with the given RRPV value.
+ * 
+ * @param[in] rrpv	RRPV values of the ways of the set.
+ * @param[in] n	Number of ways.
+ * @param[in] v	RRPV value to search.
+ * @return int	First way with that value, -1 if there is none.
+ */
+static inline int find_rrpv(const uint8_t *rrpv, int n, int v)
+{
+	int k = 0;
+#if defined(__AVX2__)
+	__m256i vv32 = _mm256_set1_epi8((char)v);
+	for (; k+32 <= n; k += 32)
+	{
+		__m256i r = _mm256_loadu_si256((const __m256i*)(rrpv+k));
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(r, vv32));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	__m128i vv16 = _mm_set1_epi8((char)v);
+	for (; k+16 <= n; k += 16)
+	{
+		__m128i r = _mm_loadu_si128((const __m128i*)(rrpv+k));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(r, vv16));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+	if (k+8 <= n)
+	{
+		__m128i r = _mm_loadl_epi64((const __m128i*)(rrpv+k));
+		// only the low 8 lanes hold ways
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(r, vv16)) & 0xFF;
+		if (mask)
+			return k + __builtin_ctz(mask);
+		k += 8;
+	}
+#elif defined(USE_NEON)
+	uint8x16_t vv16 = vdupq_n_u8(v);
+	for (; k+16 <= n; k += 16)
+	{
+		uint8x16_t eq = vceqq_u8(vld1q_u8(rrpv+k), vv16);
+		// 4 bits of mask per way
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+			vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (mask)
+			return k + __builtin_ctzll(mask)/4;
+	}
+#endif
+	for (; k < n; k++)
+	{
+		if (rrpv[k] == v)
+			return k;
+	}
+	return -1;
+}
+
+/*
+ * Adds a value to all the RRPV values of a set, saturating at 255.
+ * 
+ * @param[in,out] rrpv	RRPV values of the ways of the set.
+ * @param[in] n	Number of ways.
+ * @param[in] d	Value to add.
+ */
+static inline void add_rrpv(uint8_t *rrpv, int n, int d)
+{
+	int k = 0;
+#if defined(__AVX2__)
+	__m256i vd32 = _mm256_set1_epi8((char)d);
+	for (; k+32 <= n; k += 32)
+	{
+		__m256i r = _mm256_loadu_si256((const __m256i*)(rrpv+k));
+		_mm256_storeu_si256((__m256i*)(rrpv+k), _mm256_adds_epu8(r, vd32));
+	}
+#endif
+#if defined(__SSE2__)
+	__m128i vd16 = _mm_set1_epi8((char)d);
+	for (; k+16 <= n; k += 16)
+	{
+		__m128i r = _mm_loadu_si128((const __m128i*)(rrpv+k));
+		_mm_storeu_si128((__m128i*)(rrpv+k), _mm_adds_epu8(r, vd16));
+	}
+	if (k+8 <= n)
+	{
+		__m128i r = _mm_loadl_epi64((const __m128i*)(rrpv+k));
+		_mm_storel_epi64((__m128i*)(rrpv+k), _mm_adds_epu8(r, vd16));
+		k += 8;
+	}
+#elif defined(USE_NEON)
+	uint8x16_t vd16 = vdupq_n_u8(d);
+	for (; k+16 <= n; k += 16)
+		vst1q_u8(rrpv+k, vqaddq_u8(vld1q_u8(rrpv+k), vd16));
+#endif
+	for (; k < n; k++)
+	{
+		int r = rrpv[k]+d;
+		rrpv[k] = (r > 255) ? 255 : r;
+	}
+}
+
+/*
+ * Selects the SRRIP victim of a set. Is equivalent to incrementing all
+ * the RRPV values until a way reaches max_rrpv and taking the first of
+ * them, but the set is aged at once by (max_rrpv - highest RRPV).
+ * 
+ * @param[in,out] rrpv	RRPV values of the ways of the set.
+ * @param[in] n	Number of ways.
+ * @param[in] max_rrpv	Max value for the RRPV parameter.
+ * @return int	Way to evict.
+ */
+static inline int find_victim(uint8_t *rrpv, int n, int max_rrpv)
+{
+	int m = max_rrpv_of(rrpv, n);
+	int way = find_rrpv(rrpv, n, m);
+	if (m < max_rrpv)
+	{
+		// age all the ways
+		add_rrpv(rrpv, n, max_rrpv-m);
+	}
+	return way;
+}
+
+/*
+ * Like find_victim, but only the ways of a mask are aged and may be
+ * chosen, used to restrict the ways where a core of a shared cache can
+ * allocate.
+ * 
+ * @param[in,out] rrpv	RRPV values of the ways.
+ * @param[in] n	Number of ways, up to 64.
+ * @param[in] max_rrpv	Max value of RRPV.
+ * @param[in] mask	Ways that may be chosen, at least one.
+ * @returns int	Way to evict.
+ */
+static inline int find_victim_in(uint8_t *rrpv, int n, int max_rrpv, uint64_t mask)
+{
+	int m = 0;
+	int way = -1;
+	for (int k=0; k<n; k++)
+	{
+		if (((mask>>k)&1) && (way < 0 || rrpv[k] > m))
+		{
+			m = rrpv[k];
+			way = k;
+		}
+	}
+	for (int k=0; k<n && m < max_rrpv; k++)
+	{
+		if ((mask>>k)&1)
+			rrpv[k] += max_rrpv-m;
+	}
+	return way;
+}
+
+
+/*
+ * Tagged next-N-line prefetcher, a miss or the first use of a
+ * prefetched line prefetches the next N lines.
+ */
+class NextLinePrefetcher : public Prefetcher
+{
+public:
+	NextLinePrefetcher(int d) : Prefetcher(PREFETCH_NEXT_LINE, d) {}
+
+	void access(uint64_t line, uint64_t pc, bool hit, bool pf_hit,
+		vector<uint64_t> &out)
+	{
+		if (hit && !pf_hit)
+			return;
+		for (int k=1; k<=degree; k++)
+			out.push_back(line+k);
+	}
+};
+
+/*
+ * Stride prefetcher with a direct mapped table indexed by the
+ * instruction, or by the page of the access when the trace has no
+ * instructions. After the same stride is seen twice in a row the next
+ * N lines of the stride are prefetched.
+ */
+class StridePrefetcher : public Prefetcher
+{
+private:
+	// entry of the stride table
+	struct Entry
+	{
+		uint64_t key;	// instruction or page of the entry
+		uint64_t last;	// last line accessed
+		int64_t stride;	// lines between the last two accesses
+		int conf;	// times the stride was repeated, up to 3
+	};
+
+	vector<Entry> table;	// stride table
+	int page_shift;	// log2 of the lines of a page
+
+public:
+
+	/*
+	 * Inits an empty stride table.
+	 * 
+	 * @param[in] d	Degree of the prefetcher.
+	 * @param[in] block	Block size of the cache.
+	 */
+	StridePrefetcher(int d, int block)
+		: Prefetcher(PREFETCH_STRIDE, d), table(STRIDE_TABLE_SIZE)
+	{
+		page_shift = page_line_shift(block);
+		for (Entry &e : table)
+			e.key = INVALID_TAG;
+	}
+
+	void access(uint64_t line, uint64_t pc, bool hit, bool pf_hit,
+		vector<uint64_t> &out)
+	{
+		// instructions and pages get different keys
+		uint64_t key = pc ? pc<<1 : ((line>>page_shift)<<1)|1;
+		Entry &e = table[(key*0x9E3779B97F4A7C15ULL)>>(64-log2_const(STRIDE_TABLE_SIZE))];
+		if (e.key != key)
+		{
+			e.key = key;
+			e.last = line;
+			e.stride = 0;
+			e.conf = 0;
+			return;
+		}
+		int64_t stride = line-e.last;
+		e.last = line;
+		if (stride == 0)
+			return;
+		if (stride == e.stride)
+		{
+			e.conf = min(e.conf+1, 3);
+		}
+		else
+		{
+			e.stride = stride;
+			e.conf = 0;
+		}
+		if (e.conf < 1)
+			return;
+		for (int k=1; k<=degree; k++)
+			out.push_back(line+e.stride*k);
+	}
+};
+
+/*
+ * Stream prefetcher, keeps a few streams of misses to nearby lines.
+ * Once a stream moved twice in the same direction it prefetches up to
+ * N lines ahead of the last access of the stream, the accesses to the
+ * prefetched lines keep the stream going.
+ */
+class StreamPrefetcher : public Prefetcher
+{
+private:
+	// state of a stream
+	struct Stream
+	{
+		bool valid;	// the stream is in use
+		uint64_t last;	// last line of the stream accessed
+		uint64_t next;	// last line of the stream prefetched
+		int dir;	// direction of the stream (1/-1), 0 if it didn't move
+		int conf;	// moves of the stream in dir, up to 3
+		uint64_t used;	// time of the last access to the stream
+	};
+
+	vector<Stream> streams;	// streams tracked
+	uint64_t clock;	// triggers seen, orders the streams by use
+
+public:
+	StreamPrefetcher(int d) : Prefetcher(PREFETCH_STREAM, d), streams(STREAM_COUNT)
+	{
+		clock = 0;
+		for (Stream &s : streams)
+		{
+			s.valid = false;
+			s.used = 0;
+		}
+	}
+
+	void access(uint64_t line, uint64_t pc, bool hit, bool pf_hit,
+		vector<uint64_t> &out)
+	{
+		if (hit && !pf_hit)
+			return;
+		clock++;
+		Stream *lru = &streams[0];
+		for (Stream &s : streams)
+		{
+			if (s.used < lru->used)
+				lru = &s;
+			if (!s.valid || line+STREAM_WINDOW < s.last || line > s.last+STREAM_WINDOW)
+				continue;
+			// access near the stream
+			s.used = clock;
+			if (line == s.last)
+				return;
+			int dir = (line > s.last) ? 1 : -1;
+			if (dir == s.dir)
+			{
+				s.conf = min(s.conf+1, 3);
+			}
+			else
+			{
+				s.dir = dir;
+				s.conf = 1;
+				s.next = line;
+			}
+			s.last = line;
+			if (s.conf < 2)
+				return;
+			// prefetch up to degree lines ahead, from the last one
+			// prefetched if it is still ahead, a miss means the lines
+			// before it were lost
+			if (!hit || (int64_t)(s.next-line)*s.dir <= 0)
+				s.next = line;
+			while ((int64_t)(s.next-line)*s.dir < degree)
+			{
+				s.next += s.dir;
+				out.push_back(s.next);
+			}
+			return;
+		}
+		// new stream, replaces the least recently used one
+		lru->valid = true;
+		lru->last = line;
+		lru->next = line;
+		lru->dir = 0;
+		lru->conf = 0;
+		lru->used = clock;
+	}
+};
+
+Prefetcher* make_prefetcher(int kind, int degree, int block)
+{
+	switch (kind)
+	{
+		case PREFETCH_NEXT_LINE:
+			return new NextLinePrefetcher(degree);
+		case PREFETCH_STRIDE:
+			return new StridePrefetcher(degree, block);
+		case PREFETCH_STREAM:
+			return new StreamPrefetcher(degree);
+	}
+	return nullptr;
+}
+
+/*
+ * Replacement policies. A policy keeps one byte of state per line (the
+ * meta array of the set) and is a template parameter of Cache, so its
+ * calls are inlined in the hot path. Every policy has:
+ * - init(k): initial state of way k.
+ * - hit(meta, n, k): way k of the set was hit.
+ * - victim(meta, n, set): returns the way to evict on a miss, it may
+ *   update the state of the set.
+ * - victim_in(meta, n, set, mask): like victim, but only the ways of
+ *   the mask may be evicted.
+ * - fill(meta, n, k, set, state): way k of the set got a new line,
+ *   state is a word of the policy for the set, 0 until it is used.
+ * - invalidate(meta, n, k): way k of the set was removed, makes it the
+ *   next victim.
+ * - get_state()/set_state(v): state of the policy besides the lines,
+ *   saved in checkpoints.
+ */
+
+/*
+ * Returns true on about 1 in 32 of the fills of a set, used by the
+ * bimodal insertion of BRRIP. Each set draws from its own xorshift
+ * state, seeded from its index on the first fill, so the draws are the
+ * same when the sets are split in shards.
+ * 
+ * @param[in] set	Index of the set.
+ * @param[in,out] state	Random state of the set, 0 if not seeded.
+ * @return bool	True if the line is inserted as SRRIP does.
+ */
+static inline bool bimodal_long(uint64_t set, uint32_t &state)
+{
+	if (state == 0)
+		state = (uint32_t)((set*0x9E3779B97F4A7C15ULL)>>32)|1;
+	state ^= state<<13;
+	state ^= state>>17;
+	state ^= state<<5;
+	return (state>>27) == 0;
+}
+
+/*
+ * Static RRIP, hits set RRPV to 0 and new lines are inserted with
+ * RRPV max-1. M is fixed at compile time if it isn't 0.
+ */
+template<int M = 0>
+class SRRIP
+{
+private:
+	int max_rrpv;	// max value for rrpv value
+
+public:
+	SRRIP(int ways, int num_sets)
+	{
+		max_rrpv = (1<<(M ? M : ((ways > 2) ? 2 : 1)))-1;
+	}
+
+	/*
+	 * Returns the max value of RRPV.
+	 * 
+	 * @returns int	Max value of RRPV.
+	 */
+	int get_max_rrpv()
+	{
+		return M ? (1<<M)-1 : max_rrpv;
+	}
+
+	uint8_t init(int k)
+	{
+		return get_max_rrpv();
+	}
+
+	void hit(uint8_t *meta, int n, int k)
+	{
+		meta[k] = 0; // hit then rrpv=0
+	}
+
+	int victim(uint8_t *meta, int n, uint64_t set)
+	{
+		// ages the set until a way reaches max rrpv
+		return find_victim(meta, n, get_max_rrpv());
+	}
+
+	int victim_in(uint8_t *meta, int n, uint64_t set, uint64_t mask)
+	{
+		return find_victim_in(meta, n, get_max_rrpv(), mask);
+	}
+
+	void fill(uint8_t *meta, int n, int k, uint64_t set, uint32_t &state)
+	{
+		meta[k] = get_max_rrpv()-1;
+	}
+
+	void invalidate(uint8_t *meta, int n, int k)
+	{
+		meta[k] = get_max_rrpv();
+	}
+
+	int64_t get_state()
+	{
+		return 0;
+	}
+
+	void set_state(int64_t v)
+	{
+	}
+};
+
+/*
+ * Bimodal RRIP, like SRRIP but most new lines are inserted with the
+ * max RRPV, so they are evicted first unless they are reused.
+ */
+template<int M = 0>
+class BRRIP
+{
+private:
+	SRRIP<M> srrip;	// hits and victims are the same of SRRIP
+
+public:
+	BRRIP(int ways, int num_sets) : srrip(ways, num_sets)
+	{
+	}
+
+	uint8_t init(int k)
+	{
+		return srrip.init(k);
+	}
+
+	void hit(uint8_t *meta, int n, int k)
+	{
+		srrip.hit(meta, n, k);
+	}
+
+	int victim(uint8_t *meta, int n, uint64_t set)
+	{
+		return srrip.victim(meta, n, set);
+	}
+
+	int victim_in(uint8_t *meta, int n, uint64_t set, uint64_t mask)
+	{
+		return srrip.victim_in(meta, n, set, mask);
+	}
+
+	void fill(uint8_t *meta, int n, int k, uint64_t set, uint32_t &state)
+	{
+		int max_rrpv = srrip.get_max_rrpv();
+		meta[k] = bimodal_long(set, state) ? max_rrpv-1 : max_rrpv;
+	}
+
+	void invalidate(uint8_t *meta, int n, int k)
+	{
+		srrip.invalidate(meta, n, k);
+	}
+
+	int64_t get_state()
+	{
+		return 0;
+	}
+
+	void set_state(int64_t v)
+	{
+	}
+};
+
+/*
+ * Dynamic RRIP, some leader sets always use SRRIP and others BRRIP,
+ * the misses of the leaders move a saturating PSEL counter and the
+ * rest of the sets follow the policy with less misses.
+ */
+template<int M = 0>
+class DRRIP
+{
+private:
+	SRRIP<M> srrip;	// hits and victims are the same of SRRIP
+	int stride;	// there is a leader of each policy every stride sets
+	int psel;	// policy selector, high values select BRRIP
+
+public:
+	DRRIP(int ways, int num_sets) : srrip(ways, num_sets)
+	{
+		// 32 leaders of each policy, or less for small caches
+		int leaders = min(DRRIP_LEADERS, num_sets/2);
+		stride = (leaders > 0) ? num_sets/leaders : 0;
+		psel = DRRIP_PSEL_MAX/2;
+	}
+
+	uint8_t init(int k)
+	{
+		return srrip.init(k);
+	}
+
+	void hit(uint8_t *meta, int n, int k)
+	{
+		srrip.hit(meta, n, k);
+	}
+
+	int victim(uint8_t *meta, int n, uint64_t set)
+	{
+		return srrip.victim(meta, n, set);
+	}
+
+	int victim_in(uint8_t *meta, int n, uint64_t set, uint64_t mask)
+	{
+		return srrip.victim_in(meta, n, set, mask);
+	}
+
+	void fill(uint8_t *meta, int n, int k, uint64_t set, uint32_t &state)
+	{
+		bool use_brrip = psel > DRRIP_PSEL_MAX/2;
+		if (stride > 0 && set%stride == 0)
+		{
+			// SRRIP leader missed
+			if (psel < DRRIP_PSEL_MAX)
+				psel++;
+			use_brrip = false;
+		}
+		else if (stride > 0 && set%stride == (uint64_t)stride/2)
+		{
+			// BRRIP leader missed
+			if (psel > 0)
+				psel--;
+			use_brrip = true;
+		}
+		int max_rrpv = srrip.get_max_rrpv();
+		if (use_brrip && !bimodal_long(set, state))
+			meta[k] = max_rrpv;
+		else
+			meta[k] = max_rrpv-1;
+	}
+
+	void invalidate(uint8_t *meta, int n, int k)
+	{
+		srrip.invalidate(meta, n, k);
+	}
+
+	int64_t get_state()
+	{
+		return psel;
+	}
+
+	void set_state(int64_t v)
+	{
+		psel = v;
+	}
+};
+
+/*
+ * True LRU, the state of a line is its age in the set, 0 is the most
+ * recently used, ways 0..n-1 start with ages 0..n-1.
+ */
+class LRU
+{
+public:
+	LRU(int ways, int num_sets)
+	{
+	}
+
+	uint8_t init(int k)
+	{
+		return k;
+	}
+
+	void hit(uint8_t *meta, int n, int k)
+	{
+		// ages the lines younger than k
+		uint8_t age = meta[k];
+		for (int j=0; j<n; j++)
+		{
+			meta[j] += (meta[j] < age);
+		}
+		meta[k] = 0;
+	}
+
+	int victim(uint8_t *meta, int n, uint64_t set)
+	{
+		return find_rrpv(meta, n, n-1);
+	}
+
+	int victim_in(uint8_t *meta, int n, uint64_t set, uint64_t mask)
+	{
+		// oldest of the ways of the mask
+		int way = -1;
+		for (int k=0; k<n; k++)
+		{
+			if (((mask>>k)&1) && (way < 0 || meta[k] > meta[way]))
+				way = k;
+		}
+		return way;
+	}
+
+	void fill(uint8_t *meta, int n, int k, uint64_t set, uint32_t &state)
+	{
+		hit(meta, n, k);
+	}
+
+	void invalidate(uint8_t *meta, int n, int k)
+	{
+		// makes way k the oldest
+		uint8_t age = meta[k];
+		for (int j=0; j<n; j++)
+		{
+			meta[j] -= (meta[j] > age);
+		}
+		meta[k] = n-1;
+	}
+
+	int64_t get_state()
+	{
+		return 0;
+	}
+
+	void set_state(int64_t v)
+	{
+	}
+};
+
+/*
+ * Tree pseudo LRU for a power of two associativity, the byte k of the
+ * set state is the node k of the tree, node k has children 2k+1 and
+ * 2k+2 and a node set to 1 points to its right subtree.
+ */
+class PLRU
+{
+public:
+	PLRU(int ways, int num_sets)
+	{
+	}
+
+	uint8_t init(int k)
+	{
+		return 0;
+	}
+
+	void hit(uint8_t *meta, int n, int k)
+	{
+		// point the path of way k away from it
+		int node = 0;
+		for (int half=n/2; half>0; half/=2)
+		{
+			int right = (k&half) != 0;
+			meta[node] = !right;
+			node = 2*node+1+right;
+		}
+	}
+
+	int victim(uint8_t *meta, int n, uint64_t set)
+	{
+		// follow the tree to the pseudo LRU way
+		int node = 0;
+		int way = 0;
+		for (int half=n/2; half>0; half/=2)
+		{
+			int right = meta[node];
+			way |= right ? half : 0;
+			node = 2*node+1+right;
+		}
+		return way;
+	}
+
+	int victim_in(uint8_t *meta, int n, uint64_t set, uint64_t mask)
+	{
+		// like victim, but a subtree without ways of the mask is skipped
+		int node = 0;
+		int way = 0;
+		for (int half=n/2; half>0; half/=2)
+		{
+			int right = meta[node];
+			uint64_t sub = (mask>>(way+(right ? half : 0)))&((1ULL<<half)-1);
+			if (sub == 0)
+				right = !right;
+			way |= right ? half : 0;
+			node = 2*node+1+right;
+		}
+		return way;
+	}
+
+	void fill(uint8_t *meta, int n, int k, uint64_t set, uint32_t &state)
+	{
+		hit(meta, n, k);
+	}
+
+	void invalidate(uint8_t *meta, int n, int k)
+	{
+		// point the path of way k towards it
+		int node = 0;
+		for (int half=n/2; half>0; half/=2)
+		{
+			int right = (k&half) != 0;
+			meta[node] = right;
+			node = 2*node+1+right;
+		}
+	}
+
+	int64_t get_state()
+	{
+		return 0;
+	}
+
+	void set_state(int64_t v)
+	{
+	}
+};
+
+// max bytes of the lines of a cache allocated up front
+static uint64_t dense_limit = DENSE_MAX_BYTES;
+
+void set_dense_limit(uint64_t bytes)
+{
+	dense_limit = bytes;
+}
+
+/*
+ * Converts a 64 bit value between the host and little endian.
+ * 
+ * @param[in] v	Value.
+ * @returns uint64_t	Value in the other order.
+ */
+static inline uint64_t le64(uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(v);
+#else
+	return v;
+#endif
+}
+
+/*
+ * Converts a 32 bit value between the host and little endian.
+ * 
+ * @param[in] v	Value.
+ * @returns uint32_t	Value in the other order.
+ */
+static inline uint32_t le32(uint32_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap32(v);
+#else
+	return v;
+#endif
+}
+
+/*
+ * Writes words as little endian, through a buffer of converted words.
+ * 
+ * @param[in] f	Output file.
+ * @param[in] v	Words in the host order.
+ * @param[in] n	Number of words.
+ * @returns bool	False on write errors.
+ */
+static bool write_le64(FILE *f, const uint64_t *v, size_t n)
+{
+	uint64_t buf[CHECKPOINT_CHUNK];
+	for (size_t k=0; k<n; k+=CHECKPOINT_CHUNK)
+	{
+		size_t m = min<size_t>(n-k, CHECKPOINT_CHUNK);
+		for (size_t i=0; i<m; i++)
+			buf[i] = le64(v[k+i]);
+		if (fwrite(buf, sizeof(uint64_t), m, f) != m)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Reads little endian words and converts them to the host order.
+ * 
+ * @param[in] f	Input file.
+ * @param[out] v	Words read.
+ * @param[in] n	Number of words.
+ * @returns bool	False if the file is truncated.
+ */
+static bool read_le64(FILE *f, uint64_t *v, size_t n)
+{
+	if (fread(v, sizeof(uint64_t), n, f) != n)
+		return false;
+	for (size_t k=0; k<n; k++)
+		v[k] = le64(v[k]);
+	return true;
+}
+
+/*
+ * Writes words as little endian, through a buffer of converted words.
+ * 
+ * @param[in] f	Output file.
+ * @param[in] v	Words in the host order.
+ * @param[in] n	Number of words.
+ * @returns bool	False on write errors.
+ */
+static bool write_le32(FILE *f, const uint32_t *v, size_t n)
+{
+	uint32_t buf[CHECKPOINT_CHUNK];
+	for (size_t k=0; k<n; k+=CHECKPOINT_CHUNK)
+	{
+		size_t m = min<size_t>(n-k, CHECKPOINT_CHUNK);
+		for (size_t i=0; i<m; i++)
+			buf[i] = le32(v[k+i]);
+		if (fwrite(buf, sizeof(uint32_t), m, f) != m)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Reads little endian words and converts them to the host order.
+ * 
+ * @param[in] f	Input file.
+ * @param[out] v	Words read.
+ * @param[in] n	Number of words.
+ * @returns bool	False if the file is truncated.
+ */
+static bool read_le32(FILE *f, uint32_t *v, size_t n)
+{
+	if (fread(v, sizeof(uint32_t), n, f) != n)
+		return false;
+	for (size_t k=0; k<n; k++)
+		v[k] = le32(v[k]);
+	return true;
+}
+
+/*
+ * Array in its own mapping of anonymous memory. The address space for
+ * the max size of the array is reserved up front and the pages only
+ * take memory when they are first written, so the array grows without
+ * moving or copying its elements and zero fills are free. Big arrays
+ * use transparent huge pages, to cut the TLB misses of the accesses to
+ * random sets.
+ */
+template<class T>
+class ArenaArray
+{
+private:
+	T *elems;	// elements, null if nothing is reserved
+	size_t count;	// elements in use
+	size_t capacity;	// elements reserved
+	size_t touched;	// elements written at some point, the rest are zero
+	size_t bytes;	// bytes of the mapping
+
+	void release()
+	{
+		if (elems != nullptr)
+			munmap(elems, bytes);
+		elems = nullptr;
+		count = capacity = touched = bytes = 0;
+	}
+
+public:
+
+	ArenaArray()
+	{
+		elems = nullptr;
+		count = capacity = touched = bytes = 0;
+	}
+
+	ArenaArray(const ArenaArray&) = delete;
+	ArenaArray& operator=(const ArenaArray&) = delete;
+
+	ArenaArray(ArenaArray &&o)
+		: ArenaArray()
+	{
+		*this = move(o);
+	}
+
+	ArenaArray& operator=(ArenaArray &&o)
+	{
+		swap(elems, o.elems);
+		swap(count, o.count);
+		swap(capacity, o.capacity);
+		swap(touched, o.touched);
+		swap(bytes, o.bytes);
+		return *this;
+	}
+
+	~ArenaArray()
+	{
+		release();
+	}
+
+	/*
+	 * Reserves space for up to n elements, the array is emptied.
+	 * 
+	 * @param[in] n	Max number of elements.
+	 */
+	void reserve(size_t n)
+	{
+		release();
+		bytes = max<size_t>((n*sizeof(T)+4095)&~(size_t)4095, 4096);
+		void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+		{
+			bytes = 0;
+			throw bad_alloc();
+		}
+#ifdef MADV_HUGEPAGE
+		if (bytes >= ARENA_HUGE_PAGE_MIN)
+			madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+		elems = (T*)p;
+		capacity = n;
+	}
+
+	/*
+	 * Changes the number of elements, the new ones are set to v.
+	 * 
+	 * @param[in] n	Number of elements, up to the space reserved.
+	 * @param[in] v	Value of the new elements.
+	 */
+	void resize(size_t n, T v = T())
+	{
+		if (n > capacity)
+			throw bad_alloc();
+		size_t fresh = max(touched, count);
+		for (size_t k=count; k<min(n, fresh); k++)
+			elems[k] = v;
+		// the pages never written are already zero
+		for (size_t k=max(count, fresh); k<n && v != T(); k++)
+			elems[k] = v;
+		count = n;
+		touched = max(touched, n);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	size_t max_size() const
+	{
+		return capacity;
+	}
+
+	T* data()
+	{
+		return elems;
+	}
+
+	T& operator[](size_t k)
+	{
+		return elems[k];
+	}
+};
+
+/*
+ * Open addressing hash table from the index bits of the sets of a cache
+ * to the slots of their lines, used when the sets are created on demand.
+ * The buckets are a flat array probed linearly, 4 in each 64 byte line,
+ * so a lookup usually touches a single line of the table, and the table
+ * takes memory for the sets touched only.
+ */
+class SetTable
+{
+private:
+	struct Bucket
+	{
+		uint64_t index;	// index bits of the set, INVALID_TAG if empty
+		long slot;	// slot of the lines of the set
+	};
+	vector<Bucket> buckets;	// power of two buckets
+	size_t used;	// buckets used
+	int shift;	// 64-log2 of the number of buckets
+
+	/*
+	 * Returns the first bucket to probe for an index.
+	 * 
+	 * @param[in] index	Index bits of a set.
+	 * @returns size_t	Bucket.
+	 */
+	size_t home(uint64_t index)
+	{
+		return (index*0x9E3779B97F4A7C15ULL)>>shift;
+	}
+
+	/*
+	 * Moves the sets to a table with twice the buckets.
+	 */
+	void grow()
+	{
+		vector<Bucket> old(buckets.size()*2, Bucket{INVALID_TAG, 0});
+		old.swap(buckets);
+		shift--;
+		for (const Bucket &b : old)
+		{
+			if (b.index == INVALID_TAG)
+				continue;
+			size_t k = home(b.index);
+			while (buckets[k].index != INVALID_TAG)
+				k = (k+1)&(buckets.size()-1);
+			buckets[k] = b;
+		}
+	}
+
+public:
+
+	SetTable()
+	{
+		clear();
+	}
+
+	/*
+	 * Removes all the sets.
+	 */
+	void clear()
+	{
+		buckets.assign(SET_TABLE_MIN_BUCKETS, Bucket{INVALID_TAG, 0});
+		used = 0;
+		shift = 64-__builtin_ctzll(SET_TABLE_MIN_BUCKETS);
+	}
+
+	/*
+	 * Returns the slot of a set.
+	 * 
+	 * @param[in] index	Index bits of the set.
+	 * @returns long	Slot of the set, -1 if it isn't in the table.
+	 */
+	long find(uint64_t index)
+	{
+		for (size_t k=home(index); ; k=(k+1)&(buckets.size()-1))
+		{
+			if (buckets[k].index == index)
+				return buckets[k].slot;
+			if (buckets[k].index == INVALID_TAG)
+				return -1;
+		}
+	}
+
+	/*
+	 * Adds a set that isn't in the table.
+	 * 
+	 * @param[in] index	Index bits of the set.
+	 * @param[in] slot	Slot of the set.
+	 */
+	void insert(uint64_t index, long slot)
+	{
+		if (2*(used+1) > buckets.size())
+			grow();
+		size_t k = home(index);
+		while (buckets[k].index != INVALID_TAG)
+			k = (k+1)&(buckets.size()-1);
+		buckets[k] = Bucket{index, slot};
+		used++;
+	}
+
+	/*
+	 * Prefetches the first bucket of an index into the host caches.
+	 * 
+	 * @param[in] index	Index bits of a set.
+	 */
+	void prefetch(uint64_t index)
+	{
+		__builtin_prefetch(&buckets[home(index)]);
+	}
+
+	/*
+	 * Returns the number of sets.
+	 * 
+	 * @returns size_t	Sets in the table.
+	 */
+	size_t size()
+	{
+		return used;
+	}
+
+	/*
+	 * Returns the sets of the table, in no particular order.
+	 * 
+	 * @param[out] sets	Index bits and slot of each set.
+	 */
+	void get_sets(vector<pair<uint64_t,long>> &sets)
+	{
+		sets.clear();
+		for (const Bucket &b : buckets)
+		{
+			if (b.index != INVALID_TAG)
+				sets.push_back(make_pair(b.index, b.slot));
+		}
+	}
+};
+
+/*
+ * Class to model a cache with a replacement policy given by Policy.
+ * The associativity and the block size may be fixed at compile time
+ * so the loops over the ways unroll and the index shift is a constant,
+ * a parameter set to 0 is taken from the constructor instead, so
+ * Cache<Policy> is the fully dynamic cache.
+ */
+template<class Policy, int Ways = 0, int LineBytes = 0>
+class Cache final : public CacheModel
+{
+private:
+	bool dense;	// all the sets are allocated up front
+	bool prefetch_sets;	// prefetch the sets of a batch before they run
+
+	/*
+	 * Returns the offset of the index bits.
+	 * 
+	 * @returns int	Offset of the index bits.
+	 */
+	int index_shift()
+	{
+		return LineBytes ? log2_const(LineBytes) : index_offset;
+	}
+
+public:
+
+	/*
+	 * Storage for the cache lines of all the sets, kept as a structure
+	 * of arrays: tags, replacement state and dirty bits are each stored
+	 * in their own contiguous array, the set in slot k owns the lines
+	 * [k*ways, (k+1)*ways) of every array. The arrays are arenas sized
+	 * for all the sets the cache may have, so sets created on demand
+	 * don't allocate or move the lines of the others.
+	 */
+	class LineStore
+	{
+	private:
+		int ways;	// lines per set
+		long num_slots;	// number of sets allocated
+		vector<uint8_t> meta_init;	// replacement state of a new set
+		ArenaArray<uint64_t> tags;	// tag of every line
+		ArenaArray<uint8_t> meta;	// replacement state of every line
+		ArenaArray<uint64_t> dirty;	// dirty bit of every line, 64 per word
+		ArenaArray<uint32_t> set_state;	// word of the policy for every set
+#ifdef CACHE_STATS
+		vector<SetStats> set_stats;	// counters of every set
+#endif
+
+	public:
+
+		LineStore()
+		{
+			ways = 0;
+			num_slots = 0;
+		}
+
+		/*
+		 * Inits an empty line storage.
+		 * 
+		 * @param[in] w	Number of ways of each set.
+		 * @param[in] policy	Policy that gives the initial state.
+		 * @param[in] max_sets	Max number of sets.
+		 */
+		LineStore(int w, Policy &policy, long max_sets)
+		{
+			ways = w;
+			num_slots = 0;
+			for (int k=0; k<ways; k++)
+				meta_init.push_back(policy.init(k));
+			tags.reserve(max_sets*ways);
+			meta.reserve(max_sets*ways);
+			dirty.reserve((max_sets*ways+63)/64);
+			set_state.reserve(max_sets);
+		}
+
+		/*
+		 * Allocates lines for n more sets, the new lines are invalid,
+		 * clean and have the initial state of the policy.
+		 * 
+		 * @param[in] n	Number of sets to add.
+		 * @returns long	Slot of the first new set.
+		 */
+		long add_sets(long n)
+		{
+			long first = num_slots;
+			num_slots += n;
+			tags.resize(num_slots*ways, INVALID_TAG);
+			meta.resize(num_slots*ways);
+			for (long k=first; k<num_slots; k++)
+				memcpy(&meta[k*ways], meta_init.data(), ways);
+			dirty.resize((num_slots*ways+63)/64);
+			set_state.resize(num_slots);
+#ifdef CACHE_STATS
+			set_stats.resize(num_slots, SetStats());
+#endif
+			return first;
+		}
+
+		/*
+		 * Returns the number of ways of each set.
+		 * 
+		 * @returns int	Number of ways.
+		 */
+		int get_ways()
+		{
+			return Ways ? Ways : ways;
+		}
+
+		/*
+		 * Returns the number of sets allocated.
+		 * 
+		 * @returns long	Number of slots.
+		 */
+		long get_slots()
+		{
+			return num_slots;
+		}
+
+		/*
+		 * Writes the arrays of the lines.
+		 * 
+		 * @param[in] f	Checkpoint file.
+		 * @returns bool	False on write errors.
+		 */
+		bool save(FILE *f)
+		{
+			return write_le64(f, tags.data(), tags.size()) &&
+				fwrite(meta.data(), 1, meta.size(), f) == meta.size() &&
+				write_le64(f, dirty.data(), dirty.size()) &&
+				write_le32(f, set_state.data(), set_state.size());
+		}
+
+		/*
+		 * Replaces the lines with n sets read from a checkpoint, each
+		 * array is read at once.
+		 * 
+		 * @param[in] f	Checkpoint file.
+		 * @param[in] n	Number of sets.
+		 * @returns bool	False if the file is truncated.
+		 */
+		bool load(FILE *f, long n)
+		{
+			if ((size_t)n*ways > tags.max_size())
+				return false;
+			num_slots = n;
+#ifdef CACHE_STATS
+			set_stats.resize(num_slots, SetStats());
+#endif
+			tags.resize(num_slots*ways);
+			meta.resize(num_slots*ways);
+			dirty.resize((num_slots*ways+63)/64);
+			set_state.resize(num_slots);
+			return read_le64(f, tags.data(), tags.size()) &&
+				fread(meta.data(), 1, meta.size(), f) == meta.size() &&
+				read_le64(f, dirty.data(), dirty.size()) &&
+				read_le32(f, set_state.data(), set_state.size());
+		}
+
+		/*
+		 * Returns the tags of the set in the given slot.
+		 * 
+		 * @param[in] slot	Slot of the set.
+		 * @returns uint64_t*	Tags of the ways of the set.
+		 */
+		uint64_t* get_tags(long slot)
+		{
+			return &tags[slot*get_ways()];
+		}
+
+		/*
+		 * Returns the replacement state of the set in the given slot.
+		 * 
+		 * @param[in] slot	Slot of the set.
+		 * @returns uint8_t*	State of the ways of the set.
+		 */
+		uint8_t* get_meta(long slot)
+		{
+			return &meta[slot*get_ways()];
+		}
+
+		/*
+		 * Returns the word of the policy for the set in the given slot.
+		 * 
+		 * @param[in] slot	Slot of the set.
+		 * @returns uint32_t*	State of the policy for the set.
+		 */
+		uint32_t* get_set_state(long slot)
+		{
+			return &set_state[slot];
+		}
+
+		/*
+		 * Prefetches the tags and the replacement state of the set in
+		 * the given slot into the host caches.
+		 * 
+		 * @param[in] slot	Slot of the set.
+		 */
+		void prefetch(long slot)
+		{
+			const char *t = (const char*)&tags[slot*get_ways()];
+			for (int k=0; k<get_ways()*(int)sizeof(uint64_t); k+=64)
+				__builtin_prefetch(t+k);
+			__builtin_prefetch(&meta[slot*get_ways()]);
+		}
+
+		/*
+		 * Returns the dirty bits of all the lines.
+		 * 
+		 * @returns uint64_t*	Dirty bitset.
+		 */
+		uint64_t* get_dirty()
+		{
+			return dirty.data();
+		}
+
+#ifdef CACHE_STATS
+		/*
+		 * Returns the counters of the set in the given slot.
+		 * 
+		 * @param[in] slot	Slot of the set.
+		 * @returns SetStats*	Counters of the set.
+		 */
+		SetStats* get_stats(long slot)
+		{
+			return &set_stats[slot];
+		}
+#endif
+	};
+
+	/*
+	 * This class models the sets of the cache, each with N posible
+	 * ways, the number of ways is set from command line. A Set is a
+	 * light view over the lines of one slot of a LineStore.
+	 */
+	class Set
+	{
+	private:
+		int s_size;	// set size (associativity)
+		uint64_t index;	// index bits of this set
+		Policy *policy;	// replacement policy of the cache
+		uint64_t *tags;	// tags of the ways of this set
+		uint8_t *meta;	// replacement state of the ways of this set
+		uint32_t *state;	// word of the policy for this set
+		uint64_t *dirty;	// dirty bitset of the line storage
+		long dirty_base;	// bit of the first way in dirty
+#ifdef CACHE_STATS
+		SetStats *stats;	// counters of this set
+#endif
+
+		/*
+		 * Sets to 1 the dirty bit of a way.
+		 * 
+		 * @param[in] k	Way of this set.
+		 */
+		void set_dirty_bit(int k)
+		{
+			long bit = dirty_base+k;
+			dirty[bit>>6] |= (uint64_t)1<<(bit&63);
+		}
+
+		/*
+		 * Clears the dirty bit of a way.
+		 * 
+		 * @param[in] k	Way of this set.
+		 */
+		void clear_dirty_bit(int k)
+		{
+			long bit = dirty_base+k;
+			dirty[bit>>6] &= ~((uint64_t)1<<(bit&63));
+		}
+
+		/*
+		 * Returns the dirty bit of a way.
+		 * 
+		 * @param[in] k	Way of this set.
+		 * @returns int	Dirty bit of the way (1/0).
+		 */
+		int get_dirty_bit(int k)
+		{
+			long bit = dirty_base+k;
+			return (dirty[bit>>6]>>(bit&63))&1;
+		}
+
+		/*
+		 * Replaces the victim of the policy with a new line.
+		 * 
+		 * @param[in] tag New tag to set.
+		 * @returns int	Way of the new line.
+		 */
+		int replace(uint64_t tag)
+		{
+			int k = policy->victim(meta, get_size(), index);
+#ifdef CACHE_STATS
+			stats->evictions += tags[k] != INVALID_TAG;
+#endif
+			policy->fill(meta, get_size(), k, index, *state);
+			// new tag
+			tags[k] = tag;
+			return k;
+		}
+
+	public:
+
+		/*
+		 * Inits a view of a cache Set.
+		 * 
+		 * @param[in] store	Storage of the cache lines.
+		 * @param[in] slot	Slot of this set in the storage.
+		 * @param[in] i	Index bits of this set.
+		 * @param[in] p	Replacement policy of the cache.
+		 */
+		Set(LineStore &store, long slot, uint64_t i, Policy *p)
+		{
+			s_size = store.get_ways();
+			index = i;
+			policy = p;
+			tags = store.get_tags(slot);
+			meta = store.get_meta(slot);
+			state = store.get_set_state(slot);
+			dirty = store.get_dirty();
+			dirty_base = slot*s_size;
+#ifdef CACHE_STATS
+			stats = store.get_stats(slot);
+			stats->index = i;
+#endif
+		}
+
+		/*
+		 * Returns the size of this cache set.
+		 * 
+		 * @returns int	Size of this cache.
+		 */
+		int get_size()
+		{
+			return Ways ? Ways : s_size;
+		}
+
+		/*
+		 * Searches for a given tag in the set ways.
+		 * 
+		 * @param[in] tag	Tag to search.
+		 * @returns int	Returns 1 if finds the way, and 0 otherwise.
+		 */
+		int read_way(uint64_t tag)
+		{
+			int k = find_tag(tags, get_size(), tag);
+#ifdef CACHE_STATS
+			stats->accesses++;
+			stats->misses += k < 0;
+#endif
+			if (k >= 0)
+			{
+				policy->hit(meta, get_size(), k);
+				return 1; // hit
+			}
+			return 0; // miss
+		}
+
+		/*
+		 * Evicts a line caused by a read request.
+		 * 
+		 * @param[in] tag New tag to set.
+		 * @returns int Returns 1 if there is a dirty eviction,
+		 * 						0 otherwise.
+		 */
+		int read_evict_way(uint64_t tag)
+		{
+			int k = replace(tag);
+
+			if (get_dirty_bit(k) == 1)
+			{
+				// clear dirty bit
+				clear_dirty_bit(k);
+				return 1;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+
+		/*
+		 * Searches for a block in this set, given a write request.
+		 * 
+		 * @param[in] tag Tag to search.
+		 */
+		int write_way(uint64_t tag)
+		{
+			int k = find_tag(tags, get_size(), tag);
+#ifdef CACHE_STATS
+			stats->accesses++;
+			stats->misses += k < 0;
+#endif
+			if (k >= 0)
+			{
+				policy->hit(meta, get_size(), k);
+				set_dirty_bit(k);
+				return 1; // hit
+			}
+			return 0; // miss
+		}
+
+		/*
+		 * Removes a cache line in this set, given a write request.
+		 * 
+		 * @param[in] tag New tag to set.
+		 * @returns int Returns 1 if there is a dirty eviction,
+		 * 						0 otherwise.
+		 */
+		int write_evict_way(uint64_t tag)
+		{
+			int k = replace(tag);
+			if (get_dirty_bit(k) == 1)
+			{
+				return 1;
+			}
+			else
+			{
+				// modified value
+				set_dirty_bit(k);
+				return 0;
+			}
+		}
+
+		/*
+		 * Replaces the victim of the policy with a new line and
+		 * reports the evicted line.
+		 * 
+		 * @param[in] tag	New tag to set.
+		 * @param[in] dirty	The new line is modified.
+		 * @param[out] old_dirty	The evicted line was modified.
+		 * @param[in] mask	Ways that may be evicted.
+		 * @returns uint64_t	Tag of the evicted line, INVALID_TAG if
+		 * 						the way was empty.
+		 */
+		uint64_t evict_way(uint64_t tag, bool dirty, bool &old_dirty, uint64_t mask = ~0ULL)
+		{
+			int k = mask == ~0ULL ? policy->victim(meta, get_size(), index) :
+				policy->victim_in(meta, get_size(), index, mask);
+#ifdef CACHE_STATS
+			stats->evictions += tags[k] != INVALID_TAG;
+#endif
+			uint64_t old_tag = tags[k];
+			old_dirty = get_dirty_bit(k);
+			policy->fill(meta, get_size(), k, index, *state);
+			tags[k] = tag;
+			if (dirty)
+				set_dirty_bit(k);
+			else
+				clear_dirty_bit(k);
+			return old_tag;
+		}
+
+		/*
+		 * Marks a line as modified if it is present, without changing
+		 * the replacement state.
+		 * 
+		 * @param[in] tag	Tag to search.
+		 * @param[in] dirty	The line is modified.
+		 * @returns bool	True if the line is present.
+		 */
+		bool update_way(uint64_t tag, bool dirty)
+		{
+			int k = find_tag(tags, get_size(), tag);
+			if (k < 0)
+				return false;
+			if (dirty)
+				set_dirty_bit(k);
+			return true;
+		}
+
+		/*
+		 * Removes a line of this set.
+		 * 
+		 * @param[in] tag	Tag to search.
+		 * @param[out] dirty	The line was modified.
+		 * @returns bool	True if the line was present.
+		 */
+		bool remove_way(uint64_t tag, bool &dirty)
+		{
+			int k = find_tag(tags, get_size(), tag);
+			if (k < 0)
+				return false;
+			dirty = get_dirty_bit(k);
+			clear_dirty_bit(k);
+			tags[k] = INVALID_TAG;
+			policy->invalidate(meta, get_size(), k);
+			return true;
+		}
+
+		/*
+		 * Looks up a line of this set.
+		 * 
+		 * @param[in] tag	Tag to search.
+		 * @param[out] dirty	The line is modified.
+		 * @returns bool	True if the line is present.
+		 */
+		bool probe_way(uint64_t tag, bool &dirty)
+		{
+			int k = find_tag(tags, get_size(), tag);
+			if (k < 0)
+				return false;
+			dirty = get_dirty_bit(k);
+			return true;
+		}
+
+		/*
+		 * Clears the modified bit of a line of this set.
+		 * 
+		 * @param[in] tag	Tag to search.
+		 * @returns bool	True if the line was present and modified.
+		 */
+		bool clean_way(uint64_t tag)
+		{
+			int k = find_tag(tags, get_size(), tag);
+			if (k < 0 || !get_dirty_bit(k))
+				return false;
+			clear_dirty_bit(k);
+			return true;
+		}
+};
+
+	// replacement policy of the cache
+	Policy policy;
+
+	// storage with the lines of all the sets
+	LineStore lines;
+
+	// table from index bits to slots of lines, used when the sets are
+	// not allocated up front
+	SetTable map_sets;
+
+#ifdef CACHE_STATS
+	// counters of each instruction of the trace
+	unordered_map<uint64_t,PcStats> pc_stats;
+#endif
+
+	/*
+	 * Inits cache values, the values of the parameters fixed at compile
+	 * time must match w and b.
+	 * @param[in] s	Size of the cache in KB.
+	 * @param[in] w	Numer of ways of the cache.
+	 * @param[in] b	Block size of the cache.
+	 * @param[in] shift	The sets are split in 2^shift shards and this
+	 * 					cache only holds the sets of one of them, the
+	 * 					ones with the same index modulo 2^shift.
+	 */
+	Cache(int s,int w,int b,int shift=0)
+		: CacheModel(s, w, b, shift), policy(w, num_sets)
+	{
+		// allocate all the sets up front if the lines of the whole cache
+		// fit in the limit, set k uses slot k>>shard_shift
+		long shard_sets = ((long)num_sets+(1<<shard_shift)-1)>>shard_shift;
+		lines = LineStore(cache_w, policy, shard_sets);
+		dense = (uint64_t)num_sets*cache_w*LINE_STORE_BYTES <= dense_limit;
+		if (dense)
+		{
+			lines.add_sets(shard_sets);
+		}
+		prefetch_sets = dense && shard_sets*cache_w*sizeof(uint64_t) >= SET_PREFETCH_MIN_BYTES;
+	}
+
+	int64_t get_policy_state()
+	{
+		return policy.get_state();
+	}
+
+	void clear_lines()
+	{
+		long shard_sets = ((long)num_sets+(1<<shard_shift)-1)>>shard_shift;
+		policy = Policy(cache_w, num_sets);
+		lines = LineStore(cache_w, policy, shard_sets);
+		map_sets.clear();
+		if (dense)
+		{
+			lines.add_sets(shard_sets);
+		}
+#ifdef CACHE_STATS
+		pc_stats.clear();
+#endif
+	}
+
+	/*
+	 * Prefetches the lines of a set into the host caches, or only its
+	 * bucket of the table when the sets are created on demand.
+	 * 
+	 * @param[in] input_index	Index bits of the set.
+	 */
+	void prefetch_set(uint64_t input_index)
+	{
+		if (dense)
+			lines.prefetch(input_index>>shard_shift);
+		else
+			map_sets.prefetch(input_index);
+	}
+
+	/*
+	 * Returns the set for the given index bits.
+	 * 
+	 * @param[in] input_index	Index bits.
+	 * @returns Set	Set of the cache for that index.
+	 */
+	Set get_set(uint64_t input_index)
+	{
+		if (dense)
+		{
+			return Set(lines, input_index>>shard_shift, input_index, &policy);
+		}
+		// create set for that index if it doesn't exist
+		long slot = map_sets.find(input_index);
+		if (slot < 0)
+		{
+			slot = lines.add_sets(1);
+			map_sets.insert(input_index, slot);
+		}
+		return Set(lines, slot, input_index, &policy);
+	}
+
+	/*
+	 * Process a load request.
+	 * 
+	 * @param set	Set selected by the index bits.
+	 * @param input_tag	Tag bits.
+	 */
+	void load(Set set, uint64_t tag)
+	{
+		if (set.read_way(tag))
+		{
+			// hit
+			// inc hit counter
+			read_hit_cnt++;
+		}
+		else
+		{
+			// miss
+			// inc miss counter
+			read_misses_cnt++;
+			// check for dirty eviction
+			if (set.read_evict_way(tag))
+			{
+				dirty_evicts_cnt++;
+			}
+		}
+	}
+
+	/*
+	 * Process a store request.
+	 * 
+	 * @param set	Set selected by the index bits.
+	 * @param input_tag	Tag bits.
+	 */
+	void store(Set set, uint64_t tag)
+	{
+		if (set.write_way(tag))
+		{
+			// hit
+			// inc hit counter
+			store_hit_cnt++;
+		}
+		else
+		{
+			// miss
+			// inc miss counter
+			store_misses_cnt++;
+			if (set.write_evict_way(tag))
+			{
+				// inc dirty
+				dirty_evicts_cnt++;
+			}
+		}
+	}
+
+	/*
+	 * Processes a write/load request.
+	 * 
+	 * @param[in] ls Indicates type of request(1:store/0:load).
+	 * @param[in] phy_addr Physical address to write/read.
+	 */
+	void run(int ls, uint64_t phy_addr)
+	{
+		uint64_t input_index = 0;
+		uint64_t input_tag = 0;
+
+		// extract index
+		input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		// extract tag
+		input_tag = phy_addr>>tag_offset;
+
+		run_set(ls, input_index, input_tag);
+	}
+
+	/*
+	 * Processes a write/load request with its address already split.
+	 * 
+	 * @param[in] ls Indicates type of request(1:store/0:load).
+	 * @param[in] input_index	Index bits of the address.
+	 * @param[in] input_tag	Tag bits of the address.
+	 */
+	void run_set(int ls, uint64_t input_index, uint64_t input_tag)
+	{
+		access_cnt++;
+		Set set = get_set(input_index);
+
+		if (ls == 0)
+		{
+			// load value
+			load(set, input_tag);
+		}
+		else
+		{
+			// write value
+			store(set, input_tag);
+		}
+	}
+
+	/*
+	 * Processes a batch of requests in order. The index and tag of a
+	 * chunk of requests are extracted at once, and when the sets are
+	 * allocated up front and don't fit in the host caches the lines of
+	 * the set of a request are prefetched a few requests before it
+	 * runs, so the misses of the host caches overlap.
+	 * 
+	 * @param[in] batch	Requests to process.
+	 * @param[in] n	Number of requests.
+	 */
+	void run_batch(const Access *batch, size_t n)
+	{
+		if (prefetcher)
+		{
+			run_prefetch(batch, n);
+			return;
+		}
+		uint64_t index[RUN_CHUNK];
+		uint64_t tag[RUN_CHUNK];
+		for (size_t first=0; first<n; first+=RUN_CHUNK)
+		{
+			const Access *a = batch+first;
+			size_t m = min<size_t>(n-first, RUN_CHUNK);
+			for (size_t k=0; k<m; k++)
+			{
+				index[k] = bit_crop(a[k].phy_addr, tag_offset, index_shift());
+				tag[k] = a[k].phy_addr>>tag_offset;
+			}
+			// the sets of a sparse cache are known after the lookup, so
+			// only the buckets of the table are prefetched
+			size_t ahead = prefetch_sets || !dense ? min<size_t>(m, SET_PREFETCH_DISTANCE) : 0;
+			for (size_t k=0; k<ahead; k++)
+				prefetch_set(index[k]);
+			for (size_t k=0; k<m; k++)
+			{
+				if (k+ahead < m && ahead > 0)
+					prefetch_set(index[k+ahead]);
+#ifdef CACHE_STATS
+				uint64_t misses = read_misses_cnt+store_misses_cnt;
+#endif
+				run_set(a[k].ls, index[k], tag[k]);
+#ifdef CACHE_STATS
+				if (a[k].pc != 0)
+				{
+					PcStats &pc = pc_stats[a[k].pc];
+					pc.accesses++;
+					pc.misses += read_misses_cnt+store_misses_cnt-misses;
+				}
+#endif
+			}
+		}
+	}
+
+#ifdef CACHE_STATS
+	void print_hot(FILE *out, int top)
+	{
+		vector<SetStats> sets;
+		for (long k=0; k<lines.get_slots(); k++)
+		{
+			if (lines.get_stats(k)->accesses > 0)
+				sets.push_back(*lines.get_stats(k));
+		}
+		size_t n = min<size_t>(top, sets.size());
+		partial_sort(sets.begin(), sets.begin()+n, sets.end(),
+			[](const SetStats &a, const SetStats &b) { return a.misses > b.misses; });
+		fprintf(out, SEP_TABLE);
+		fprintf(out, "# Hot sets:\n");
+		fprintf(out, "%-12s%-12s%-12s%-12s\n", "# Set", "Accesses", "Misses", "Evictions");
+		for (size_t k=0; k<n; k++)
+		{
+			fprintf(out, "%-12" PRIu64 "%-12" PRIu64 "%-12" PRIu64 "%-12" PRIu64 "\n",
+				sets[k].index, sets[k].accesses, sets[k].misses, sets[k].evictions);
+		}
+		fprintf(out, "\n");
+
+		// sets by evictions, in power of two buckets
+		vector<uint64_t> hist;
+		for (const SetStats &st : sets)
+		{
+			size_t b = st.evictions ? 64-__builtin_clzll(st.evictions) : 0;
+			if (b >= hist.size())
+				hist.resize(b+1, 0);
+			hist[b]++;
+		}
+		hist[0] += num_sets-sets.size();
+		fprintf(out, SEP_TABLE);
+		fprintf(out, "# Set conflict histogram:\n");
+		fprintf(out, "%-24s%-12s\n", "# Evictions", "Sets");
+		for (size_t b=0; b<hist.size(); b++)
+		{
+			uint64_t lo = b ? (uint64_t)1<<(b-1) : 0;
+			uint64_t hi = b ? ((uint64_t)1<<b)-1 : 0;
+			string range = to_string(lo)+"-"+to_string(hi);
+			fprintf(out, "%-24s%-12" PRIu64 "\n", range.c_str(), hist[b]);
+		}
+		fprintf(out, "\n");
+
+		if (pc_stats.empty())
+			return;
+		vector<pair<uint64_t,PcStats>> pcs(pc_stats.begin(), pc_stats.end());
+		n = min<size_t>(top, pcs.size());
+		partial_sort(pcs.begin(), pcs.begin()+n, pcs.end(),
+			[](const pair<uint64_t,PcStats> &a, const pair<uint64_t,PcStats> &b) {
+				return a.second.misses > b.second.misses;
+			});
+		fprintf(out, SEP_TABLE);
+		fprintf(out, "# Hot instructions:\n");
+		fprintf(out, "%-20s%-12s%-12s\n", "# PC", "Accesses", "Misses");
+		for (size_t k=0; k<n; k++)
+		{
+			fprintf(out, "0x%-18" PRIx64 "%-12" PRIu64 "%-12" PRIu64 "\n", pcs[k].first,
+				pcs[k].second.accesses, pcs[k].second.misses);
+		}
+		fprintf(out, "\n");
+	}
+#endif
+
+	/*
+	 * Fills the victim of a miss in a set.
+	 * 
+	 * @param[in] index	Index bits of the set.
+	 * @param[in] tag	Tag of the evicted line.
+	 * @param[in] dirty	The evicted line was modified.
+	 * @param[out] victim	Victim to fill.
+	 */
+	void set_victim(uint64_t index, uint64_t tag, bool dirty, Victim &victim)
+	{
+		victim.valid = tag != INVALID_TAG;
+		victim.dirty = victim.valid && dirty;
+		victim.phy_addr = (tag<<tag_offset)|(index<<index_offset);
+	}
+
+	bool access(int ls, uint64_t phy_addr, Victim &victim)
+	{
+		access_cnt++;
+		uint64_t input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		uint64_t input_tag = phy_addr>>tag_offset;
+		Set set = get_set(input_index);
+		victim.valid = false;
+
+		if (ls == 0 ? set.read_way(input_tag) : set.write_way(input_tag))
+		{
+			// hit
+			if (ls == 0)
+				read_hit_cnt++;
+			else
+				store_hit_cnt++;
+			return true;
+		}
+
+		// miss
+		if (ls == 0)
+			read_misses_cnt++;
+		else
+			store_misses_cnt++;
+		bool dirty;
+		uint64_t old_tag = set.evict_way(input_tag, ls != 0, dirty, way_mask);
+		set_victim(input_index, old_tag, dirty, victim);
+		if (victim.dirty)
+		{
+			dirty_evicts_cnt++;
+		}
+		return false;
+	}
+
+	bool fill(uint64_t phy_addr, bool dirty, bool allocate, Victim &victim)
+	{
+		uint64_t input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		uint64_t input_tag = phy_addr>>tag_offset;
+		Set set = get_set(input_index);
+		victim.valid = false;
+
+		if (set.update_way(input_tag, dirty))
+			return true;
+		if (allocate)
+		{
+			bool old_dirty;
+			uint64_t old_tag = set.evict_way(input_tag, dirty, old_dirty);
+			set_victim(input_index, old_tag, old_dirty, victim);
+		}
+		return false;
+	}
+
+	bool invalidate(uint64_t phy_addr, bool &dirty)
+	{
+		uint64_t input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		uint64_t input_tag = phy_addr>>tag_offset;
+		return get_set(input_index).remove_way(input_tag, dirty);
+	}
+
+	bool clean(uint64_t phy_addr)
+	{
+		uint64_t input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		uint64_t input_tag = phy_addr>>tag_offset;
+		return get_set(input_index).clean_way(input_tag);
+	}
+
+	bool probe(uint64_t phy_addr, bool &dirty)
+	{
+		uint64_t input_index = bit_crop(phy_addr, tag_offset, index_shift());
+		uint64_t input_tag = phy_addr>>tag_offset;
+		return get_set(input_index).probe_way(input_tag, dirty);
+	}
+
+	/*
+	 * The cache is saved as its counters, the state of the policy, the
+	 * number of sets allocated, the index and slot of each set created
+	 * on demand and the arrays of the lines.
+	 */
+	bool save(FILE *f)
+	{
+		CacheCounters cnt = get_counters();
+		uint64_t head[9] = {cnt.access, cnt.read_hit, cnt.store_hit, cnt.read_misses,
+			cnt.store_misses, cnt.dirty_evicts, (uint64_t)policy.get_state(),
+			(uint64_t)lines.get_slots(), (uint64_t)map_sets.size()};
+		bool ok = write_le64(f, head, 9);
+		vector<pair<uint64_t,long>> sets;
+		map_sets.get_sets(sets);
+		for (size_t k=0; ok && k<sets.size(); k++)
+		{
+			uint64_t rec[2] = {sets[k].first, (uint64_t)sets[k].second};
+			ok = write_le64(f, rec, 2);
+		}
+		return ok && lines.save(f);
+	}
+
+	bool load(FILE *f)
+	{
+		uint64_t head[9];
+		if (!read_le64(f, head, 9))
+			return false;
+		CacheCounters cnt = {head[0], head[1], head[2], head[3], head[4], head[5]};
+		int64_t state = (int64_t)head[6];
+		uint64_t slots = head[7];
+		uint64_t mapped = head[8];
+		// the sets of a dense cache are all allocated
+		if (dense ? (slots != (uint64_t)lines.get_slots() || mapped != 0) : mapped != slots)
+			return false;
+		set_counters(cnt);
+		policy.set_state(state);
+		map_sets.clear();
+		for (uint64_t k=0; k<mapped; k++)
+		{
+			uint64_t rec[2];
+			if (!read_le64(f, rec, 2) || rec[1] >= slots ||
+				rec[0] >= (uint64_t)num_sets || map_sets.find(rec[0]) >= 0)
+				return false;
+			map_sets.insert(rec[0], rec[1]);
+		}
+		return lines.load(f, slots);
+	}
+};
+
+
+/*
+ * Creates a cache with the replacement policy given, for a geometry with
+ * the associativity and block size W and B (0 if they are dynamic).
+ */
+template<int W, int B>
+CacheModel* make_cache_policy(int s, int w, int b, int policy, int shift)
+{
+	// M of the RRIP policies, dynamic if the associativity is
+	const int m = W ? ((W > 2) ? 2 : 1) : 0;
+	switch (policy)
+	{
+		case POLICY_BRRIP:
+			return new Cache<BRRIP<m>,W,B>(s, w, b, shift);
+		case POLICY_DRRIP:
+			return new Cache<DRRIP<m>,W,B>(s, w, b, shift);
+		case POLICY_LRU:
+			return new Cache<LRU,W,B>(s, w, b, shift);
+		case POLICY_PLRU:
+			return new Cache<PLRU,W,B>(s, w, b, shift);
+	}
+	return new Cache<SRRIP<m>,W,B>(s, w, b, shift);
+}
+
+/*
+ * Creates a cache with a block size fixed at compile time, if it is
+ * one of the common sizes.
+ */
+template<int W>
+CacheModel* make_cache_ways(int s, int w, int b, int policy, int shift)
+{
+	switch (b)
+	{
+		case 32:
+			return make_cache_policy<W,32>(s, w, b, policy, shift);
+		case 64:
+			return make_cache_policy<W,64>(s, w, b, policy, shift);
+		case 128:
+			return make_cache_policy<W,128>(s, w, b, policy, shift);
+	}
+	return make_cache_policy<0,0>(s, w, b, policy, shift);
+}
+
+CacheModel* make_cache(int s, int w, int b, int policy, int shift)
+{
+#ifndef CACHE_DYNAMIC_ONLY
+	switch (w)
+	{
+		case 1:
+			return make_cache_ways<1>(s, w, b, policy, shift);
+		case 2:
+			return make_cache_ways<2>(s, w, b, policy, shift);
+		case 4:
+			return make_cache_ways<4>(s, w, b, policy, shift);
+		case 8:
+			return make_cache_ways<8>(s, w, b, policy, shift);
+		case 16:
+			return make_cache_ways<16>(s, w, b, policy, shift);
+		case 32:
+			return make_cache_ways<32>(s, w, b, policy, shift);
+	}
+#endif
+	return make_cache_policy<0,0>(s, w, b, policy, shift);
+}
+
+/*
+ * Reads an uncompressed trace from a file descriptor, like stdin.
+ */
+class FdSource : public ByteSource
+{
+private:
+	int fd;	// file descriptor of the trace
+
+public:
+	FdSource(int f)
+	{
+		fd = f;
+	}
+
+	long read(char *dst, size_t n)
+	{
+		while (1)
+		{
+			ssize_t r = ::read(fd, dst, n);
+			if (r >= 0 || errno != EINTR)
+				return r;
+		}
+	}
+};
+
+/*
+ * Reads a gzip compressed trace, zlib reads uncompressed files as is.
+ */
+class GzipSource : public ByteSource
+{
+private:
+	gzFile file;	// zlib handle of the trace
+
+public:
+	GzipSource(gzFile f)
+	{
+		file = f;
+		gzbuffer(file, TRACE_BUF_SIZE);
+	}
+
+	~GzipSource()
+	{
+		gzclose(file);
+	}
+
+	long read(char *dst, size_t n)
+	{
+		return gzread(file, dst, n);
+	}
+};
+
+#ifdef HAVE_ZSTD
+/*
+ * Reads a zstd compressed trace.
+ */
+class ZstdSource : public ByteSource
+{
+private:
+	FILE *file;	// compressed trace
+	ZSTD_DStream *stream;	// decompression context
+	vector<char> in;	// compressed data buffer
+	ZSTD_inBuffer in_buf;	// pending compressed data
+
+public:
+	ZstdSource(FILE *f) : in(ZSTD_DStreamInSize())
+	{
+		file = f;
+		stream = ZSTD_createDStream();
+		ZSTD_initDStream(stream);
+		in_buf.src = in.data();
+		in_buf.size = 0;
+		in_buf.pos = 0;
+	}
+
+	~ZstdSource()
+	{
+		ZSTD_freeDStream(stream);
+		fclose(file);
+	}
+
+	long read(char *dst, size_t n)
+	{
+		ZSTD_outBuffer out_buf = {dst, n, 0};
+		while (out_buf.pos == 0)
+		{
+			if (in_buf.pos == in_buf.size)
+			{
+				// read more compressed data
+				in_buf.size = fread(in.data(), 1, in.size(), file);
+				in_buf.pos = 0;
+				if (in_buf.size == 0)
+					return ferror(file) ? -1 : 0;
+			}
+			size_t r = ZSTD_decompressStream(stream, &out_buf, &in_buf);
+			if (ZSTD_isError(r))
+				return -1;
+		}
+		return out_buf.pos;
+	}
+};
+#endif
+
+ByteSource* open_trace(const char *path)
+{
+	if (strcmp(path, "-") == 0)
+	{
+		return new FdSource(STDIN_FILENO);
+	}
+	size_t len = strlen(path);
+	if (len > 4 && strcmp(path+len-4, ".zst") == 0)
+	{
+#ifdef HAVE_ZSTD
+		FILE *f = fopen(path, "rb");
+		return f ? new ZstdSource(f) : nullptr;
+#else
+		fprintf(stderr, "zstd support not compiled in\n");
+		return nullptr;
+#endif
+	}
+	gzFile f = gzopen(path, "rb");
+	return f ? new GzipSource(f) : nullptr;
+}
+
+/*
+ * Class to read the accesses of a trace, each line of the trace has
+ * the form "# <ls> <address> <instructions>". Lines are split in place
+ * over a large read buffer, so no strings are built while parsing.
+ */
+class TraceReader
+{
+private:
+	unique_ptr<ByteSource> src;	// raw data of the trace
+	vector<char> buf;	// input buffer
+	char *pos;	// start of the next line in buf
+	char *end;	// end of the valid data in buf
+	bool eof;	// no more data in src
+
+	/*
+	 * Moves the pending data to the start of the buffer and reads
+	 * more data after it.
+	 */
+	void fill()
+	{
+		size_t pending = end-pos;
+		memmove(buf.data(), pos, pending);
+		pos = buf.data();
+		end = pos+pending;
+		while (!eof && end < buf.data()+buf.size())
+		{
+			long n = src->read(end, buf.data()+buf.size()-end);
+			if (n > 0)
+			{
+				end += n;
+				break;
+			}
+			if (n < 0)
+				fprintf(stderr, "error reading the trace\n");
+			eof = true;
+		}
+	}
+
+	/*
+	 * Parses a trace line.
+	 * 
+	 * @param[in] line	Start of the line.
+	 * @param[in] len	Length of the line, without the new line.
+	 * @param[out] a	Access of the line.
+	 * @returns bool	False if the line is not an access.
+	 */
+	static bool parse(const char *line, size_t len, Access &a)
+	{
+		if (len < 5)
+			return false;
+		a.ls = (int)line[2]-48;
+		// address starts after the type, up to 16 hex digits
+		const char *p = line+4;
+		const char *e = line+len;
+		while (p < e && *p == ' ')
+			p++;
+		if (e-p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+			p += 2;
+		if (e-p > 16)
+			e = p+16;
+		uint64_t addr = 0;
+		const char *digits = p;
+		for (; p < e; p++)
+		{
+			int d = hex_digit(*p);
+			if (d < 0)
+				break;
+			addr = (addr<<4)|d;
+		}
+		if (p == digits)
+			return false;
+		a.phy_addr = addr;
+		// instruction count and optional instruction address
+		a.insts = 0;
+		a.pc = 0;
+		e = line+len;
+		while (p < e && *p != ' ')
+			p++;
+		while (p < e && *p == ' ')
+			p++;
+		uint64_t insts = 0;
+		for (; p < e && *p >= '0' && *p <= '9'; p++)
+			insts = insts*10+(*p-'0');
+		a.insts = (uint32_t)min<uint64_t>(insts, UINT32_MAX);
+		while (p < e && *p != ' ')
+			p++;
+		while (p < e && *p == ' ')
+			p++;
+		if (e-p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+			p += 2;
+		for (int d; p < e && (d = hex_digit(*p)) >= 0; p++)
+			a.pc = (a.pc<<4)|d;
+		return true;
+	}
+
+	/*
+	 * Returns the value of a hexadecimal digit.
+	 * 
+	 * @param[in] c	Character of the digit.
+	 * @returns int	Value of the digit, -1 if c is not a digit.
+	 */
+	static int hex_digit(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c-'0';
+		c |= 0x20; // lower case
+		if (c >= 'a' && c <= 'f')
+			return c-'a'+10;
+		return -1;
+	}
+
+public:
+
+	/*
+	 * Inits a reader of a trace.
+	 * 
+	 * @param[in] s	Source of the trace, owned by the reader.
+	 */
+	TraceReader(ByteSource *s) : src(s), buf(TRACE_BUF_SIZE)
+	{
+		pos = end = buf.data();
+		eof = false;
+	}
+
+	/*
+	 * Reads the next access of the trace.
+	 * 
+	 * @param[out] a	Access read.
+	 * @returns bool	False at the end of the trace.
+	 */
+	bool next(Access &a)
+	{
+		while (1)
+		{
+			char *nl = (char*)memchr(pos, '\n', end-pos);
+			char *line = pos;
+			if (nl)
+			{
+				pos = nl+1;
+			}
+			else if (eof || (pos == buf.data() && end == buf.data()+buf.size()))
+			{
+				// last line without new line, or line longer than buf
+				if (pos == end)
+					return false;
+				nl = end;
+				pos = end;
+			}
+			else
+			{
+				fill();
+				continue;
+			}
+			if (parse(line, nl-line, a))
+				return true;
+		}
+	}
+};
+
+
+/*
+ * Reads a trace on a producer thread, which decompresses and parses it
+ * into a ring of batches of accesses, while the simulation thread
+ * consumes the batches already decoded.
+ */
+class ThreadedTraceReader : public AccessSource
+{
+private:
+	TraceReader reader;	// parser of the trace
+	vector<vector<Access>> ring;	// batches of accesses
+	vector<size_t> sizes;	// accesses in each batch
+	long produced;	// batches published by the producer
+	long consumed;	// batches released by the consumer
+	bool done;	// the producer reached the end of the trace
+	bool stop;	// the consumer is not reading anymore
+	bool holding;	// the consumer holds the batch consumed
+	mutex mtx;	// protects the ring counters
+	condition_variable cv;	// signals changes of the ring counters
+	thread producer;	// thread that runs produce
+
+	/*
+	 * Main loop of the producer, fills the free batches until the end
+	 * of the trace.
+	 */
+	void produce()
+	{
+		while (1)
+		{
+			long slot;
+			{
+				unique_lock<mutex> lock(mtx);
+				cv.wait(lock, [this]{ return stop || produced-consumed < ACCESS_RING_SLOTS; });
+				if (stop)
+					return;
+				slot = produced%ACCESS_RING_SLOTS;
+			}
+			// fill the batch out of the lock, the consumer doesn't use it
+			vector<Access> &batch = ring[slot];
+			size_t n = 0;
+			while (n < batch.size() && reader.next(batch[n]))
+				n++;
+			{
+				lock_guard<mutex> lock(mtx);
+				sizes[slot] = n;
+				if (n > 0)
+					produced++;
+				if (n < batch.size())
+					done = true;
+			}
+			cv.notify_all();
+			if (n < batch.size())
+				return;
+		}
+	}
+
+public:
+
+	/*
+	 * Inits the reader and starts the producer thread.
+	 * 
+	 * @param[in] s	Source of the trace, owned by the reader.
+	 */
+	ThreadedTraceReader(ByteSource *s)
+		: reader(s),
+		  ring(ACCESS_RING_SLOTS, vector<Access>(ACCESS_BATCH_SIZE)),
+		  sizes(ACCESS_RING_SLOTS, 0)
+	{
+		produced = 0;
+		consumed = 0;
+		done = false;
+		stop = false;
+		holding = false;
+		producer = thread(&ThreadedTraceReader::produce, this);
+	}
+
+	~ThreadedTraceReader()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stop = true;
+		}
+		cv.notify_all();
+		producer.join();
+	}
+
+	/*
+	 * Returns the next batch of accesses, the previous batch returned
+	 * is released and must not be used anymore.
+	 * 
+	 * @param[out] batch	Accesses of the batch.
+	 * @param[out] n	Number of accesses of the batch.
+	 * @returns bool	False at the end of the trace.
+	 */
+	bool next(const Access *&batch, size_t &n)
+	{
+		unique_lock<mutex> lock(mtx);
+		if (holding)
+		{
+			consumed++;
+			holding = false;
+			cv.notify_all();
+		}
+		cv.wait(lock, [this]{ return done || produced > consumed; });
+		if (produced == consumed)
+			return false;
+		long slot = consumed%ACCESS_RING_SLOTS;
+		batch = ring[slot].data();
+		n = sizes[slot];
+		holding = true;
+		return true;
+	}
+};
+
+/*
+ * Header of the binary trace format, it is followed by the records:
+ * - plain traces use a BinTraceRecord per access.
+ * - delta traces (flag BIN_TRACE_DELTA) use 32 bit words per access,
+ *   (zigzag(address - previous address) << 1) | ls. When the delta
+ *   doesn't fit in 31 bits the word holds BIN_DELTA_ESCAPE instead
+ *   and the next two words are the low and high halves of the address.
+ *   With the flag BIN_TRACE_PC a word zigzag(pc - previous pc) follows,
+ *   or BIN_PC_ESCAPE and the two halves of the pc. Delta traces don't
+ *   keep the instruction counts.
+ * All the fields are little endian, whatever the host is.
+ */
+struct BinTraceHeader
+{
+	char magic[8];	// BIN_TRACE_MAGIC
+	uint32_t version;	// BIN_TRACE_VERSION
+	uint32_t flags;	// format flags
+	uint64_t count;	// number of accesses
+	uint64_t reserved;	// zero
+};
+
+// access of a plain binary trace
+struct BinTraceRecord
+{
+	uint64_t addr;	// physical address
+	uint64_t pc;	// instruction of the access
+	uint32_t insts;	// instructions since the previous access
+	uint32_t ls;	// type of request(1:store/0:load)
+};
+
+/*
+ * Decodes the zigzag encoding of a delta.
+ * 
+ * @param[in] zz	Encoded delta.
+ * @returns int64_t	Delta.
+ */
+static inline int64_t unzigzag(uint64_t zz)
+{
+	return (int64_t)(zz>>1)^-(int64_t)(zz&1);
+}
+
+/*
+ * Writes accesses in the binary trace format.
+ */
+class BinaryTraceWriter
+{
+private:
+	FILE *file;	// output trace
+	bool delta;	// delta encoded records
+	bool pcs;	// delta records keep the instructions
+	uint64_t count;	// accesses written
+	uint64_t prev_addr;	// address of the last access written
+	uint64_t prev_pc;	// instruction of the last access written
+
+	/*
+	 * Writes words of a delta record.
+	 * 
+	 * @param[in] w	Words in the host order.
+	 * @param[in] n	Number of words.
+	 */
+	void write_words(const uint32_t *w, int n)
+	{
+		uint32_t le[3];
+		for (int k=0; k<n; k++)
+			le[k] = le32(w[k]);
+		fwrite(le, sizeof(uint32_t), n, file);
+	}
+
+	/*
+	 * Writes the header with the current access count.
+	 */
+	void write_header()
+	{
+		BinTraceHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, BIN_TRACE_MAGIC, sizeof(h.magic));
+		h.version = le32(BIN_TRACE_VERSION);
+		h.flags = le32(delta ? BIN_TRACE_DELTA|(pcs ? BIN_TRACE_PC : 0) : 0);
+		h.count = le64(count);
+		fwrite(&h, sizeof(h), 1, file);
+	}
+
+public:
+
+	/*
+	 * Inits a writer, the header is written with a zero count and is
+	 * completed by close.
+	 * 
+	 * @param[in] f	Output file, must be seekable.
+	 * @param[in] d	Use delta encoded records.
+	 * @param[in] p	Delta records keep the instructions, plain records
+	 * 				always keep them.
+	 */
+	BinaryTraceWriter(FILE *f, bool d, bool p)
+	{
+		file = f;
+		delta = d;
+		pcs = p;
+		count = 0;
+		prev_addr = 0;
+		prev_pc = 0;
+		setvbuf(file, nullptr, _IOFBF, TRACE_BUF_SIZE);
+		write_header();
+	}
+
+	/*
+	 * Writes an access.
+	 * 
+	 * @param[in] a	Access to write.
+	 */
+	void write(const Access &a)
+	{
+		uint64_t addr = a.phy_addr;
+		uint32_t ls = (a.ls != 0);
+		if (!delta)
+		{
+			BinTraceRecord rec = {le64(addr), le64(a.pc), le32(a.insts), le32(ls)};
+			fwrite(&rec, sizeof(rec), 1, file);
+		}
+		else
+		{
+			int64_t d = addr-prev_addr;
+			uint64_t zz = ((uint64_t)d<<1)^(uint64_t)(d>>63);
+			if (zz < BIN_DELTA_ESCAPE)
+			{
+				uint32_t rec = (uint32_t)(zz<<1)|ls;
+				write_words(&rec, 1);
+			}
+			else
+			{
+				uint32_t rec[3] = {((uint32_t)BIN_DELTA_ESCAPE<<1)|ls,
+					(uint32_t)addr, (uint32_t)(addr>>32)};
+				write_words(rec, 3);
+			}
+			prev_addr = addr;
+			if (pcs)
+			{
+				d = a.pc-prev_pc;
+				zz = ((uint64_t)d<<1)^(uint64_t)(d>>63);
+				if (zz < BIN_PC_ESCAPE)
+				{
+					uint32_t rec = (uint32_t)zz;
+					write_words(&rec, 1);
+				}
+				else
+				{
+					uint32_t rec[3] = {BIN_PC_ESCAPE, (uint32_t)a.pc,
+						(uint32_t)(a.pc>>32)};
+					write_words(rec, 3);
+				}
+				prev_pc = a.pc;
+			}
+		}
+		count++;
+	}
+
+	/*
+	 * Completes the header and closes the file.
+	 * 
+	 * @returns bool	False if there were write errors.
+	 */
+	bool close()
+	{
+		bool ok = !ferror(file) && fseek(file, 0, SEEK_SET) == 0;
+		if (ok)
+			write_header();
+		ok = !ferror(file) && ok;
+		return (fclose(file) == 0) && ok;
+	}
+
+	/*
+	 * Returns the number of accesses written.
+	 * 
+	 * @returns uint64_t	Accesses written.
+	 */
+	uint64_t get_count()
+	{
+		return count;
+	}
+};
+
+/*
+ * Replays a binary trace, the file is mapped in memory and the records
+ * are decoded from the mapped pages in small batches.
+ */
+class BinaryTraceReader : public AccessSource
+{
+private:
+	const uint8_t *data;	// mapped file
+	size_t size;	// size of the mapped file
+	const uint8_t *pos;	// next record
+	const uint8_t *end;	// end of the records
+	bool delta;	// delta encoded records
+	bool pcs;	// delta records keep the instructions
+	uint64_t left;	// accesses not decoded yet
+	uint64_t prev_addr;	// address of the last access decoded
+	uint64_t prev_pc;	// instruction of the last access decoded
+	vector<Access> batch;	// decoded accesses
+
+	/*
+	 * Inits a reader over a mapped binary trace.
+	 */
+	BinaryTraceReader(const uint8_t *d, size_t s)
+		: batch(ACCESS_BATCH_SIZE/16)
+	{
+		data = d;
+		size = s;
+		const BinTraceHeader *h = (const BinTraceHeader*)data;
+		pos = data+sizeof(BinTraceHeader);
+		end = data+size;
+		delta = le32(h->flags) & BIN_TRACE_DELTA;
+		pcs = le32(h->flags) & BIN_TRACE_PC;
+		left = le64(h->count);
+		prev_addr = 0;
+		prev_pc = 0;
+	}
+
+	/*
+	 * Decodes the next delta record.
+	 * 
+	 * @param[in,out] rec	Next word, moved after the record.
+	 * @param[in] rec_end	End of the words.
+	 * @param[out] a	Decoded access.
+	 * @returns bool	False if the record is truncated.
+	 */
+	bool decode_delta(const uint32_t *&rec, const uint32_t *rec_end, Access &a)
+	{
+		const uint32_t *r = rec;
+		uint32_t w = le32(r[0]);
+		uint32_t zz = w>>1;
+		uint64_t addr = prev_addr;
+		if (zz != BIN_DELTA_ESCAPE)
+		{
+			addr += unzigzag(zz);
+			r++;
+		}
+		else if (r+3 <= rec_end)
+		{
+			addr = le32(r[1])|((uint64_t)le32(r[2])<<32);
+			r += 3;
+		}
+		else
+		{
+			return false;
+		}
+		uint64_t pc = 0;
+		if (pcs)
+		{
+			if (r >= rec_end)
+				return false;
+			uint32_t p = le32(r[0]);
+			if (p != BIN_PC_ESCAPE)
+			{
+				pc = prev_pc+unzigzag(p);
+				r++;
+			}
+			else if (r+3 <= rec_end)
+			{
+				pc = le32(r[1])|((uint64_t)le32(r[2])<<32);
+				r += 3;
+			}
+			else
+			{
+				return false;
+			}
+			prev_pc = pc;
+		}
+		a.ls = w&1;
+		a.insts = 0;
+		a.phy_addr = addr;
+		a.pc = pc;
+		prev_addr = addr;
+		rec = r;
+		return true;
+	}
+
+public:
+
+	~BinaryTraceReader()
+	{
+		munmap((void*)data, size);
+	}
+
+	/*
+	 * Checks if a file is a binary trace.
+	 * 
+	 * @param[in] path	Path of the file.
+	 * @returns bool	True if the file starts with the binary magic.
+	 */
+	static bool is_binary(const char *path)
+	{
+		char magic[8];
+		FILE *f = fopen(path, "rb");
+		if (f == nullptr)
+			return false;
+		bool bin = fread(magic, sizeof(magic), 1, f) == 1 &&
+			memcmp(magic, BIN_TRACE_MAGIC, sizeof(magic)) == 0;
+		fclose(f);
+		return bin;
+	}
+
+	/*
+	 * Maps a binary trace.
+	 * 
+	 * @param[in] path	Path of the trace.
+	 * @returns BinaryTraceReader*	Reader of the trace, nullptr on errors.
+	 */
+	static BinaryTraceReader* open(const char *path)
+	{
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return nullptr;
+		struct stat st;
+		void *d = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(BinTraceHeader))
+			d = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (d == MAP_FAILED)
+			return nullptr;
+		madvise(d, st.st_size, MADV_SEQUENTIAL);
+		const BinTraceHeader *h = (const BinTraceHeader*)d;
+		bool plain = !(le32(h->flags) & BIN_TRACE_DELTA);
+		if (le32(h->version) != BIN_TRACE_VERSION || (plain &&
+			le64(h->count) > (st.st_size-sizeof(BinTraceHeader))/sizeof(BinTraceRecord)))
+		{
+			fprintf(stderr, "bad binary trace header\n");
+			munmap(d, st.st_size);
+			return nullptr;
+		}
+		return new BinaryTraceReader((const uint8_t*)d, st.st_size);
+	}
+
+	bool next(const Access *&out, size_t &n)
+	{
+		n = 0;
+		if (!delta)
+		{
+			const BinTraceRecord *rec = (const BinTraceRecord*)pos;
+			while (n < batch.size() && left > 0)
+			{
+				batch[n].ls = le32(rec[n].ls)&1;
+				batch[n].insts = le32(rec[n].insts);
+				batch[n].phy_addr = le64(rec[n].addr);
+				batch[n].pc = le64(rec[n].pc);
+				n++;
+				left--;
+			}
+			pos = (const uint8_t*)(rec+n);
+		}
+		else
+		{
+			const uint32_t *rec = (const uint32_t*)pos;
+			const uint32_t *rec_end = (const uint32_t*)end;
+			while (n < batch.size() && left > 0 && rec < rec_end)
+			{
+				if (!decode_delta(rec, rec_end, batch[n]))
+				{
+					// truncated trace
+					left = 0;
+					break;
+				}
+				n++;
+				left--;
+			}
+			if (rec >= rec_end)
+				left = 0;
+			pos = (const uint8_t*)rec;
+		}
+		out = batch.data();
+		return n > 0;
+	}
+
+	uint64_t seek(uint64_t n)
+	{
+		if (!delta)
+		{
+			// fixed size records
+			uint64_t skipped = min(n, left);
+			pos += skipped*sizeof(BinTraceRecord);
+			left -= skipped;
+			return skipped;
+		}
+		// the addresses are relative, walk the records without
+		// decoding the accesses
+		const uint32_t *rec = (const uint32_t*)pos;
+		const uint32_t *rec_end = (const uint32_t*)end;
+		uint64_t skipped = 0;
+		Access a;
+		while (skipped < n && left > 0 && rec < rec_end &&
+			decode_delta(rec, rec_end, a))
+		{
+			skipped++;
+			left--;
+		}
+		pos = (const uint8_t*)rec;
+		return skipped;
+	}
+};
+
+AccessSource* open_text_accesses(ByteSource *src)
+{
+	return new ThreadedTraceReader(src);
+}
+
+AccessSource* open_accesses(const char *path)
+{
+	if (strcmp(path, "-") != 0 && BinaryTraceReader::is_binary(path))
+	{
+		return BinaryTraceReader::open(path);
+	}
+	ByteSource *src = open_trace(path);
+	return src ? open_text_accesses(src) : nullptr;
+}
+
+SyntheticConfig synthetic_defaults(int kind)
+{
+	SyntheticConfig cfg;
+	cfg.kind = kind;
+	cfg.accesses = 10000000;
+	cfg.footprint = 64<<20;
+	cfg.stride = kind == SYNTH_STRIDE ? 4096 : 8;
+	cfg.streams = 1;
+	cfg.item = 64;
+	cfg.alpha = 0.99;
+	cfg.stores = 0.25;
+	cfg.seed = 1;
+	return cfg;
+}
+
+bool check_synthetic(const SyntheticConfig &cfg)
+{
+	if (cfg.footprint < 8 || cfg.stride == 0 || cfg.streams <= 0 ||
+		cfg.item == 0 || cfg.item > cfg.footprint)
+	{
+		fprintf(stderr, "invalid synthetic working set\n");
+		return false;
+	}
+	if (cfg.alpha <= 0 || cfg.stores < 0 || cfg.stores > 1)
+	{
+		fprintf(stderr, "invalid synthetic alpha or stores\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Generator of the accesses of a synthetic trace, see open_synthetic.
+ * The ranks of zipf and the steps of chase are scrambled with a
+ * bijection of the items, so the hot items and the cycle are spread
+ * over the working set.
+ */
+class SyntheticSource : public AccessSource
+{
+private:
+	SyntheticConfig cfg;	// parameters of the trace
+	uint64_t left;	// accesses left to generate
+	uint64_t rng;	// xorshift state
+	uint64_t items;	// items of the working set
+	uint64_t mask;	// power of two minus one covering the items
+	int half;	// shift of the scrambling, half of the bits of mask
+	vector<uint64_t> offsets;	// next offset of each stream
+	int stream;	// stream of the next access
+	uint64_t state;	// position of chase in its cycle
+	double zipf_hx1;	// constants of the rejection inversion of zipf
+	double zipf_hn;
+	double zipf_s;
+	vector<Access> buf;	// batch generated
+
+	uint64_t next_random()
+	{
+		rng ^= rng<<13;
+		rng ^= rng>>7;
+		rng ^= rng<<17;
+		return rng;
+	}
+
+	double uniform()
+	{
+		return (next_random()>>11)/9007199254740992.0;
+	}
+
+	/*
+	 * Bijection of [0, mask], mixes the bits of a number.
+	 * 
+	 * @param[in] x	Number to mix.
+	 * @returns uint64_t	Number it is mapped to.
+	 */
+	uint64_t mix(uint64_t x)
+	{
+		x ^= x>>half;
+		x = (x*0x9E3779B97F4A7C15ULL)&mask;
+		x ^= x>>half;
+		x = (x*0xC2B2AE3D27D4EB4FULL)&mask;
+		x ^= x>>half;
+		return x;
+	}
+
+	/*
+	 * Maps an item to another one, a bijection of the items.
+	 * 
+	 * @param[in] x	Item.
+	 * @returns uint64_t	Item it is mapped to.
+	 */
+	uint64_t scramble(uint64_t x)
+	{
+		// walks the bijection of [0, mask] until it lands on an item
+		do
+			x = mix(x);
+		while (x >= items);
+		return x;
+	}
+
+	// h, its integral and the inverse of the integral of zipf
+	double zipf_h(double x)
+	{
+		return exp(-cfg.alpha*log(x));
+	}
+
+	static double expm1_div(double x)
+	{
+		return fabs(x) > 1e-8 ? expm1(x)/x : 1+x*0.5*(1+x/3*(1+0.25*x));
+	}
+
+	static double log1p_div(double x)
+	{
+		return fabs(x) > 1e-8 ? log1p(x)/x : 1-x*(0.5-x*(1.0/3-0.25*x));
+	}
+
+	double zipf_hint(double x)
+	{
+		double l = log(x);
+		return expm1_div((1-cfg.alpha)*l)*l;
+	}
+
+	double zipf_hint_inv(double x)
+	{
+		double t = max(x*(1-cfg.alpha), -1.0);
+		return exp(log1p_div(t)*x);
+	}
+
+	/*
+	 * Draws a rank of zipf, by rejection inversion (Hormann and
+	 * Derflinger), in constant time for any number of items.
+	 * 
+	 * @returns uint64_t	Rank, 0 for the hottest item.
+	 */
+	uint64_t zipf_rank()
+	{
+		while (true)
+		{
+			double u = zipf_hn+uniform()*(zipf_hx1-zipf_hn);
+			double x = zipf_hint_inv(u);
+			double k = min(max(floor(x+0.5), 1.0), (double)items);
+			if (k-x <= zipf_s || u >= zipf_hint(k+0.5)-zipf_h(k))
+				return (uint64_t)k-1;
+		}
+	}
+
+public:
+
+	SyntheticSource(const SyntheticConfig &c)
+		: buf(min<uint64_t>(c.accesses, ACCESS_BATCH_SIZE))
+	{
+		cfg = c;
+		left = cfg.accesses;
+		rng = 0x9E3779B97F4A7C15ULL^(cfg.seed*0xBF58476D1CE4E5B9ULL);
+		if (rng == 0)
+			rng = 1;
+		items = cfg.footprint/cfg.item;
+		int bits = items > 1 ? 64-__builtin_clzll(items-1) : 0;
+		mask = bits == 64 ? ~0ULL : (1ULL<<bits)-1;
+		half = (bits+1)/2;
+		if (half == 0)
+			half = 1;
+		stream = 0;
+		state = 0;
+		for (int s=0; s<cfg.streams; s++)
+			offsets.push_back((cfg.footprint/cfg.streams*s)&~7ULL);
+		zipf_hx1 = zipf_hint(1.5)-1;
+		zipf_hn = zipf_hint(items+0.5);
+		zipf_s = 2-zipf_hint_inv(zipf_hint(2.5)-zipf_h(2));
+	}
+
+	bool next(const Access *&batch, size_t &n)
+	{
+		if (left == 0)
+			return false;
+		n = min<uint64_t>(left, buf.size());
+		for (size_t k=0; k<n; k++)
+		{
+			Access &a = buf[k];
+			a.pc = SYNTH_PC+cfg.kind*0x100;
+			switch (cfg.kind)
+			{
+				case SYNTH_SEQ:
+				case SYNTH_STRIDE:
+					a.phy_addr = offsets[stream];
+					a.pc += stream*4;
+					offsets[stream] = (offsets[stream]+cfg.stride)%cfg.footprint;
+					stream = stream+1 == cfg.streams ? 0 : stream+1;
+					break;
+				case SYNTH_RANDOM:
+					a.phy_addr = next_random()%(cfg.footprint/8)*8;
+					break;
+				case SYNTH_ZIPF:
+					a.phy_addr = scramble(zipf_rank())*cfg.item;
+					break;
+				case SYNTH_CHASE:
+				{
+					// full period LCG over [0, mask], mixed and walked
+					// until it lands on an item
+					uint64_t x;
+					do
+					{
+						state = (state*6364136223846793005ULL+1442695040888963407ULL)&mask;
+						x = mix(state);
+					}
+					while (x >= items);
+					a.phy_addr = x*cfg.item;
+					break;
+				}
+			}
+			a.ls = uniform() < cfg.stores;
+		}
+		left -= n;
+		batch = buf.data();
+		return true;
+	}
+};
+
+AccessSource* open_synthetic(const SyntheticConfig &cfg)
+{
+	return new SyntheticSource(cfg);
+}
+
+int convert_trace(AccessSource *trace, const char *path, bool delta)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == nullptr)
+	{
+		fprintf(stderr, "can't create %s\n", path);
+		return 1;
+	}
+	const Access *batch;
+	size_t batch_size;
+	bool more = trace->next(batch, batch_size);
+	// delta traces keep the instructions if the first batch has them
+	bool pcs = false;
+	for (size_t k=0; more && k<batch_size; k++)
+		pcs |= batch[k].pc != 0;
+	BinaryTraceWriter writer(f, delta, pcs);
+	while (more)
+	{
+		for (size_t k=0; k<batch_size; k++)
+		{
+			writer.write(batch[k]);
+		}
+		more = trace->next(batch, batch_size);
+	}
+	uint64_t count = writer.get_count();
+	if (!writer.close())
+	{
+		fprintf(stderr, "error writing %s\n", path);
+		return 1;
+	}
+	printf("%-30s%-10llu\n", "Converted accesses:", (unsigned long long)count);
+	return 0;
+}
+
+/*
+ * Header of the checkpoint format, it is followed by the configuration
+ * of each cache and by the state of each cache written by
+ * CacheModel::save. All the fields are little endian, whatever the host
+ * is.
+ */
+struct CheckpointHeader
+{
+	char magic[8];	// CHECKPOINT_MAGIC
+	uint32_t version;	// CHECKPOINT_VERSION
+	uint32_t caches;	// number of caches
+	uint64_t offset;	// accesses of the trace run before the checkpoint
+	uint64_t reserved;	// zero
+};
+
+bool save_checkpoint(const char *path, Sweep &sweep, uint64_t offset)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == nullptr)
+		return false;
+	CheckpointHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+	h.version = le32(CHECKPOINT_VERSION);
+	h.caches = le32(sweep.size());
+	h.offset = le64(offset);
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	for (size_t k=0; ok && k<sweep.size(); k++)
+	{
+		const CacheConfig &cfg = sweep.get_config(k);
+		uint32_t rec[4] = {(uint32_t)cfg.size, (uint32_t)cfg.ways, (uint32_t)cfg.block,
+			(uint32_t)cfg.policy};
+		ok = write_le32(f, rec, 4);
+	}
+	for (size_t k=0; ok && k<sweep.size(); k++)
+		ok = sweep.get_cache(k).save(f);
+	return (fclose(f) == 0) && ok;
+}
+
+FILE* open_checkpoint(const char *path, vector<CacheConfig> &configs, uint64_t &offset)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == nullptr)
+		return nullptr;
+	CheckpointHeader h;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+		memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) == 0 &&
+		le32(h.version) == CHECKPOINT_VERSION;
+	for (uint32_t k=0; ok && k<le32(h.caches); k++)
+	{
+		uint32_t rec[4];
+		ok = read_le32(f, rec, 4);
+		CacheConfig cfg = {(int)rec[0], (int)rec[1], (int)rec[2], (int)rec[3]};
+		configs.push_back(cfg);
+	}
+	if (!ok)
+	{
+		fclose(f);
+		return nullptr;
+	}
+	offset = le64(h.offset);
+	return f;
+}
+
+bool load_checkpoint(FILE *f, Sweep &sweep)
+{
+	bool ok = true;
+	for (size_t k=0; ok && k<sweep.size(); k++)
+		ok = sweep.get_cache(k).load(f);
+	fclose(f);
+	return ok;
+}
+
+int parse_policy(const char *name)
+{
+	for (int k=0; k<(int)(sizeof(policy_names)/sizeof(policy_names[0])); k++)
+	{
+		if (strcmp(name, policy_names[k]) == 0)
+			return k;
+	}
+	return -1;
+}
+
+vector<int> parse_list(const char *str)
+{
+	vector<int> values;
+	const char *p = str;
+	while (*p)
+	{
+		char *e;
+		values.push_back(strtol(p, &e, 10));
+		p = (*e == ',') ? e+1 : e+strlen(e);
+	}
+	return values;
+}
+
+vector<int> parse_policies(const char *str)
+{
+	vector<int> policies;
+	string list(str);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == string::npos)
+			end = list.size();
+		policies.push_back(parse_policy(list.substr(start, end-start).c_str()));
+		start = end+1;
+	}
+	return policies;
+}
+
+bool check_config(const CacheConfig &cfg, string &error)
+{
+	if (cfg.size <= 0 || cfg.ways <= 0 || cfg.block <= 0 ||
+		(long)cfg.size*1024 < (long)cfg.ways*cfg.block)
+	{
+		error = "invalid cache configuration "+to_string(cfg.size)+" "+
+			to_string(cfg.ways)+" "+to_string(cfg.block);
+		return false;
+	}
+	if (cfg.policy < 0)
+	{
+		error = "unknown replacement policy";
+		return false;
+	}
+	if (cfg.policy == POLICY_LRU && cfg.ways > 256)
+	{
+		error = "lru supports up to 256 ways";
+		return false;
+	}
+	if (cfg.policy == POLICY_PLRU && (cfg.ways&(cfg.ways-1)) != 0)
+	{
+		error = "plru needs a power of two associativity";
+		return false;
+	}
+	return true;
+}
+
+} // namespace cachesim
@@ -0,0 +1,3681 @@
+/*
+ * file: cachesim.h
+ * 
+ * Cache simulation library, the model of the cache simulator without
+ * its command line, to embed it in other programs.
+ * 
+ * A cache is created for a geometry and a replacement policy with
+ * make_cache, it takes the requests one by one (CacheModel::run), or
+ * as batches of decoded accesses (CacheModel::run_batch), and its
+ * counters are read with get_counters and cleared with reset_counters,
+ * while clear also empties the lines. The traces are read as batches
+ * of accesses from an AccessSource (open_accesses, or ArraySource for
+ * arrays already in memory), and Sweep, ShardedCache and
+ * CacheHierarchy run a trace in several caches, in the shards of one
+ * cache or in the levels of a hierarchy.
+ * 
+ * Objects:
+ * The replacement policy is a template parameter of the cache and the
+ * common geometries use a cache specialized at compile time and the
+ * rest a dynamic one (see cachesim.cpp). The cache lines of all the
+ * sets are kept in a LineStore, as contiguous arrays of tags,
+ * replacement state (RRPV values, LRU ages...) and dirty bits, and Set
+ * objects are views over the lines of one set, selected directly by the
+ * index bits. When the lines of the whole cache take more than a
+ * memory limit (set_dense_limit), the sets are created on demand and
+ * found through a flat hash table instead. A CacheHierarchy chains
+ * several caches as the levels of a memory hierarchy, and a Prefetcher
+ * may fill lines ahead of the demand accesses of a cache.
+ * 
+ * Building with -DCACHE_STATS adds per set and per instruction
+ * counters, the library and the programs that use it must be built
+ * with the same flags.
+ */
+
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+// tag of a cache line that holds no data
+#define INVALID_TAG (~(uint64_t)0)
+
+// accesses per batch and batches in the ring of the threaded reader
+#define ACCESS_BATCH_SIZE (1<<16)
+#define ACCESS_RING_SLOTS 4
+
+// chunks of accesses shared by the workers of a parallel sweep
+#define SHARED_CHUNKS 8
+
+// accesses per batch and batches in the queue of each shard
+#define SHARD_BATCH_SIZE 4096
+#define SHARD_QUEUE_SLOTS 16
+
+// interval samples in the ring of each thread of the interval log
+#define STATS_RING_SLOTS 4096
+
+// prefetches don't cross pages of this size in bytes
+#define PREFETCH_PAGE_BYTES 4096
+
+// sets sampled by the utility monitors of UCP
+#define UMON_SETS 32
+
+// the addresses of each core of a shared cache have the core in these bits
+#define CORE_ADDR_SHIFT 56
+
+// accesses between the repartitions of UCP by default
+#define UCP_PERIOD (1<<20)
+
+// bytes of a coherence message without data
+#define COHERENCE_CTRL_BYTES 8
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdexcept>
+#include <chrono>
+
+// vector extensions used by the set search kernels
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
+namespace cachesim
+{
+
+using namespace std;
+
+/*
+ * Extracts a sequence of bits from an integer number given a
+ * superior and inferior limit.
+ * 
+ * @param[in] num	Integer number.
+ * @param[in] h_lim	Superior bit index.
+ * @param[in] l_lim	Inferior bit index.
+ * @return uint64_t	Number given by the sequence of bits.
+ * 
+ */
+static inline uint64_t bit_crop(uint64_t num, int h_lim, int l_lim)
+{
+	uint64_t mask = (h_lim < 64) ? ((uint64_t)1<<h_lim)-1 : ~(uint64_t)0;
+	return (num&mask)>>l_lim;
+}
+
+
+/*
+ * Searches a tag in the tags of a set, comparing several ways at once.
+ * The vector loops build a hit mask of the compared ways, as the
+ * tags of a set are unique the first bit of the mask is the hit.
+ * 
+ * @param[in] tags	Tags of the ways of the set.
+ * @param[in] n	Number of ways.
+ * @param[in] tag	Tag to search.
+ * @return int	Way that holds the tag, -1 if it isn't in the set.
+ */
+static inline int find_tag(const uint64_t *tags, int n, uint64_t tag)
+{
+	int k = 0;
+#if defined(__AVX2__)
+	__m256i vtag4 = _mm256_set1_epi64x(tag);
+	for (; k+4 <= n; k += 4)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(tags+k));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, vtag4)));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE4_1__)
+	__m128i vtag2 = _mm_set1_epi64x(tag);
+	for (; k+2 <= n; k += 2)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(tags+k));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, vtag2)));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#elif defined(__SSE2__)
+	__m128i vtag2 = _mm_set1_epi64x(tag);
+	for (; k+2 <= n; k += 2)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(tags+k));
+		// both 32 bit halves must match
+		__m128i eq = _mm_cmpeq_epi32(v, vtag2);
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+		if (mask)
+			return k + __builtin_ctz(mask);
+	}
+#elif defined(USE_NEON)
+	uint64x2_t vtag2 = vdupq_n_u64(tag);
+	for (; k+2 <= n; k += 2)
+	{
+		uint64x2_t eq = vceqq_u64(vld1q_u64(tags+k), vtag2);
+		// 32 bits of mask per way
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u32(vmovn_u64(eq)), 0);
+		if (mask)
+			return k + __builtin_ctzll(mask)/32;
+	}
+#endif
+	for (; k < n; k++)
+	{
+		if (tags[k] == tag)
+			return k;
+	}
+	return -1;
+}
+
+// decoded access of a trace
+struct Access
+{
+	int ls;	// type of request(1:store/0:load)
+	uint32_t insts;	// instructions since the previous request, 0 if the trace has none
+	uint64_t phy_addr;	// physical address of the request
+	uint64_t pc;	// instruction of the request, 0 if the trace has none
+};
+
+#ifdef CACHE_STATS
+// counters of a set, kept by the instrumented build
+struct SetStats
+{
+	uint64_t index;	// index bits of the set
+	uint64_t accesses;	// requests to the set
+	uint64_t misses;	// misses of the set
+	uint64_t evictions;	// valid lines replaced in the set
+};
+
+// counters of an instruction, kept by the instrumented build
+struct PcStats
+{
+	uint64_t accesses;	// requests of the instruction
+	uint64_t misses;	// misses of the instruction
+};
+#endif
+
+// values of the counters of a cache
+struct CacheCounters
+{
+	uint64_t access;	// accesses
+	uint64_t read_hit;	// read hits
+	uint64_t store_hit;	// store hits
+	uint64_t read_misses;	// read misses
+	uint64_t store_misses;	// store misses
+	uint64_t dirty_evicts;	// dirty evictions
+};
+
+// line evicted from a cache
+struct Victim
+{
+	bool valid;	// a line was evicted
+	bool dirty;	// the line was modified
+	uint64_t phy_addr;	// address of the first byte of the line
+};
+
+/*
+ * Returns the base 2 logarithm of a power of two at compile time.
+ * 
+ * @param[in] n	Power of two.
+ * @return int	log2(n).
+ */
+constexpr int log2_const(int n)
+{
+	return (n <= 1) ? 0 : 1+log2_const(n/2);
+}
+
+/*
+ * Returns the base 2 logarithm of the lines of a prefetch page, 0 when
+ * the lines are as large as a page or larger.
+ * 
+ * @param[in] block	Block size in bytes, a power of two.
+ * @return int	log2(PREFETCH_PAGE_BYTES/block).
+ */
+inline int page_line_shift(int block)
+{
+	int shift = 0;
+	while (((uint64_t)block<<shift) < PREFETCH_PAGE_BYTES)
+		shift++;
+	return shift;
+}
+
+
+// prefetchers of the caches
+enum PrefetchKind
+{
+	PREFETCH_NONE,
+	PREFETCH_NEXT_LINE,
+	PREFETCH_STRIDE,
+	PREFETCH_STREAM
+};
+
+// names of the prefetchers, in PrefetchKind order
+static const char *const prefetch_names[] = {"none", "next-line", "stride", "stream"};
+
+// lines prefetched ahead of each trigger by default, per PrefetchKind
+static const int prefetch_degrees[] = {0, 1, 2, 4};
+
+// values of the prefetch counters of a cache
+struct PrefetchCounters
+{
+	uint64_t issued;	// prefetches that filled a line
+	uint64_t redundant;	// prefetches of lines already present
+	uint64_t useful;	// prefetched lines hit by a demand access
+	uint64_t unused;	// prefetched lines evicted before any use
+	uint64_t pollution;	// demand misses of lines evicted by prefetches
+};
+
+/*
+ * Interface of the prefetchers. A prefetcher sees every demand access
+ * of its cache as a line number and returns the lines to prefetch,
+ * the cache fills them like misses and keeps the counters.
+ */
+class Prefetcher
+{
+protected:
+	int kind;	// PrefetchKind of the prefetcher
+	int degree;	// lines prefetched ahead of each trigger
+
+public:
+	Prefetcher(int k, int d)
+	{
+		kind = k;
+		degree = d;
+	}
+
+	virtual ~Prefetcher() {}
+
+	/*
+	 * Trains the prefetcher with a demand access.
+	 * 
+	 * @param[in] line	Line number of the access (address/block size).
+	 * @param[in] pc	Instruction of the access, 0 if unknown.
+	 * @param[in] hit	The access hit.
+	 * @param[in] pf_hit	The access was the first use of a prefetched
+	 * 						line.
+	 * @param[out] out	Lines to prefetch are appended here.
+	 */
+	virtual void access(uint64_t line, uint64_t pc, bool hit, bool pf_hit,
+		vector<uint64_t> &out) = 0;
+
+	/*
+	 * Returns the kind of the prefetcher.
+	 * 
+	 * @returns int	PrefetchKind of the prefetcher.
+	 */
+	int get_kind()
+	{
+		return kind;
+	}
+
+	/*
+	 * Returns the degree of the prefetcher.
+	 * 
+	 * @returns int	Lines prefetched ahead of each trigger.
+	 */
+	int get_degree()
+	{
+		return degree;
+	}
+};
+
+/*
+ * Creates a prefetcher.
+ * 
+ * @param[in] kind	Prefetcher to create, a PrefetchKind.
+ * @param[in] degree	Lines prefetched ahead of each trigger.
+ * @param[in] block	Block size of the cache.
+ * @returns Prefetcher*	New prefetcher, nullptr for PREFETCH_NONE.
+ */
+Prefetcher* make_prefetcher(int kind, int degree, int block);
+
+
+/*
+ * Interface of the simulated caches, holds the geometry and the
+ * counters of the cache. The lines and the requests are handled by
+ * Cache.
+ */
+class CacheModel
+{
+protected:
+	int cache_s;	// cache size in KB
+	int cache_w;	// cache associativity
+	int cache_b;	// cache block size in bytes
+	int index_offset;	// offset of the index bits
+	int tag_offset;	// offset of the tag bits
+	int srrip_m;	// value of M for SRRIP policy
+	int num_sets;	// number of sets given by the index bits
+	int shard_shift;	// log2 of the shards the sets are split in
+	uint64_t access_cnt;	// access counter
+	uint64_t read_hit_cnt;	// read hit counter
+	uint64_t store_hit_cnt;	// store hit counter
+	uint64_t read_misses_cnt; // read misses counter
+	uint64_t store_misses_cnt;	// store misses counter
+	uint64_t dirty_evicts_cnt;	// dirty evictions counter
+	unique_ptr<Prefetcher> prefetcher;	// prefetcher of the cache, may be null
+	PrefetchCounters pf_cnt;	// prefetch counters
+	int page_shift;	// log2 of the lines of a page
+	uint64_t way_mask;	// ways where the misses of access may allocate
+	unordered_set<uint64_t> prefetched;	// prefetched lines not used yet
+	vector<uint64_t> polluted;	// lines evicted by prefetches, by hash
+	vector<uint64_t> candidates;	// lines to prefetch of an access
+
+	/*
+	 * Removes an evicted line from the prefetched lines.
+	 * 
+	 * @param[in] victim	Line evicted.
+	 * @returns bool	True if it was a prefetched line not used.
+	 */
+	bool drop_prefetched(const Victim &victim)
+	{
+		if (!victim.valid || prefetched.erase(victim.phy_addr>>index_offset) == 0)
+			return false;
+		pf_cnt.unused++;
+		return true;
+	}
+
+	/*
+	 * Returns the slot of a line in the lines evicted by prefetches.
+	 * 
+	 * @param[in] line	Line number.
+	 * @returns uint64_t&	Slot of the line.
+	 */
+	uint64_t& polluted_slot(uint64_t line)
+	{
+		return polluted[(line*0x9E3779B97F4A7C15ULL)>>(64-__builtin_ctzll(polluted.size()))];
+	}
+
+	/*
+	 * Processes a batch of requests with the prefetcher, the demand
+	 * accesses go through access and the prefetches through fill.
+	 * A prefetched line is useful if a demand access hits it, the
+	 * demand lines evicted by prefetches are kept in a table as big as
+	 * the cache, a demand miss of one of them is a pollution miss.
+	 * 
+	 * @param[in] batch	Requests to process.
+	 * @param[in] n	Number of requests.
+	 */
+	void run_prefetch(const Access *batch, size_t n)
+	{
+		Victim victim;
+		for (size_t k=0; k<n; k++)
+		{
+			uint64_t line = batch[k].phy_addr>>index_offset;
+			bool hit = access(batch[k].ls, batch[k].phy_addr, victim);
+			bool pf_hit = false;
+			if (hit)
+			{
+				pf_hit = prefetched.erase(line) > 0;
+				pf_cnt.useful += pf_hit;
+			}
+			else
+			{
+				drop_prefetched(victim);
+				uint64_t &slot = polluted_slot(line);
+				if (slot == line)
+				{
+					pf_cnt.pollution++;
+					slot = INVALID_TAG;
+				}
+			}
+
+			candidates.clear();
+			prefetcher->access(line, batch[k].pc, hit, pf_hit, candidates);
+			for (uint64_t p : candidates)
+			{
+				// physical pages after the current one are unrelated
+				if ((p>>page_shift) != (line>>page_shift))
+					continue;
+				if (fill(p<<index_offset, false, true, victim))
+				{
+					pf_cnt.redundant++;
+					continue;
+				}
+				pf_cnt.issued++;
+				prefetched.insert(p);
+				polluted_slot(p) = INVALID_TAG;
+				if (victim.dirty)
+					dirty_evicts_cnt++;
+				if (victim.valid && !drop_prefetched(victim))
+					polluted_slot(victim.phy_addr>>index_offset) = victim.phy_addr>>index_offset;
+			}
+		}
+	}
+
+public:
+
+	/*
+	 * Inits cache values.
+	 * @param[in] s	Size of the cache in KB.
+	 * @param[in] w	Numer of ways of the cache.
+	 * @param[in] b	Block size of the cache.
+	 * @param[in] shift	The sets are split in 2^shift shards and this
+	 * 					cache only holds the sets of one of them, the
+	 * 					ones with the same index modulo 2^shift.
+	 */
+	CacheModel(int s,int w,int b,int shift)
+	{
+		cache_s = s;	// cache size in KB
+		cache_w = w;	// associativity
+		cache_b = b;	// block size in bytes
+		access_cnt=0;	// inits access counter
+		read_hit_cnt = 0;	// inits read hit counter
+		store_hit_cnt = 0;	// inits store hit counter
+		read_misses_cnt = 0;	// inits read misses counter
+		store_misses_cnt = 0;	// inits store misses counter
+		dirty_evicts_cnt = 0;	// inits dirty eviction counter
+
+		// definition of M SRRIP param
+		if(cache_w>2)
+			srrip_m = 2;
+		else
+			srrip_m = 1;
+
+		// calculate index offset
+		index_offset = (int)round(log2(cache_b));
+
+		// calculate tag offset
+		tag_offset = index_offset + (int)(log2(cache_s*pow(2,10)/(cache_w*cache_b)));
+
+		num_sets = 1<<(tag_offset-index_offset);
+		shard_shift = shift;
+		pf_cnt = PrefetchCounters();
+		page_shift = 0;
+		way_mask = ~0ULL;
+	}
+
+	virtual ~CacheModel() {}
+
+	/*
+	 * Processes a write/load request.
+	 * 
+	 * @param[in] ls Indicates type of request(1:store/0:load).
+	 * @param[in] phy_addr Physical address to write/read.
+	 */
+	virtual void run(int ls, uint64_t phy_addr) = 0;
+
+	/*
+	 * Processes a batch of requests in order.
+	 * 
+	 * @param[in] batch	Requests to process.
+	 * @param[in] n	Number of requests.
+	 */
+	virtual void run_batch(const Access *batch, size_t n) = 0;
+
+	/*
+	 * Processes a write/load request like run, and reports the line
+	 * evicted by a miss.
+	 * 
+	 * @param[in] ls Indicates type of request(1:store/0:load).
+	 * @param[in] phy_addr Physical address to write/read.
+	 * @param[out] victim	Line evicted by the request.
+	 * @returns bool	True if the request hit.
+	 */
+	virtual bool access(int ls, uint64_t phy_addr, Victim &victim) = 0;
+
+	/*
+	 * Writes a line that comes from another cache, if the line is
+	 * present its replacement state isn't changed. Doesn't change the
+	 * counters.
+	 * 
+	 * @param[in] phy_addr	Physical address of the line.
+	 * @param[in] dirty	The line is modified.
+	 * @param[in] allocate	Insert the line if it isn't present.
+	 * @param[out] victim	Line evicted to insert the new one.
+	 * @returns bool	True if the line was present.
+	 */
+	virtual bool fill(uint64_t phy_addr, bool dirty, bool allocate, Victim &victim) = 0;
+
+	/*
+	 * Removes a line from the cache. Doesn't change the counters.
+	 * 
+	 * @param[in] phy_addr	Physical address of the line.
+	 * @param[out] dirty	The removed line was modified.
+	 * @returns bool	True if the line was present.
+	 */
+	virtual bool invalidate(uint64_t phy_addr, bool &dirty) = 0;
+
+	/*
+	 * Clears the modified bit of a line, the line stays in the cache.
+	 * Doesn't change the counters.
+	 * 
+	 * @param[in] phy_addr	Physical address of the line.
+	 * @returns bool	True if the line was present and modified.
+	 */
+	virtual bool clean(uint64_t phy_addr) = 0;
+
+	/*
+	 * Looks up a line without changing the replacement state or the
+	 * counters.
+	 * 
+	 * @param[in] phy_addr	Physical address of the line.
+	 * @param[out] dirty	The line is modified.
+	 * @returns bool	True if the line is present.
+	 */
+	virtual bool probe(uint64_t phy_addr, bool &dirty) = 0;
+
+	/*
+	 * Writes the lines, the replacement state and the counters of the
+	 * cache to a checkpoint.
+	 * 
+	 * @param[in] f	Checkpoint file.
+	 * @returns bool	False on write errors.
+	 */
+	virtual bool save(FILE *f) = 0;
+
+	/*
+	 * Restores the state written by save into a cache with the same
+	 * configuration.
+	 * 
+	 * @param[in] f	Checkpoint file.
+	 * @returns bool	False if the checkpoint is truncated or doesn't
+	 * 					match the cache.
+	 */
+	virtual bool load(FILE *f) = 0;
+
+	/*
+	 * Removes all the lines of the cache and restores the initial state
+	 * of the replacement policy. Doesn't change the counters.
+	 */
+	virtual void clear_lines() = 0;
+
+	/*
+	 * Returns the state of the replacement policy besides the lines,
+	 * the PSEL counter of DRRIP and 0 for the other policies.
+	 * 
+	 * @returns int64_t	State of the policy.
+	 */
+	virtual int64_t get_policy_state() = 0;
+
+#ifdef CACHE_STATS
+	/*
+	 * Prints the sets and the instructions with more misses, and the
+	 * histogram of the evictions of the sets.
+	 * 
+	 * @param[in] out	Stream to print to.
+	 * @param[in] top	Number of sets and instructions to print.
+	 */
+	virtual void print_hot(FILE *out, int top) = 0;
+#endif
+
+	/*
+	 * Restricts the ways where the misses of access allocate, the lines
+	 * in the other ways can still be hit. Used to partition a cache
+	 * shared by several cores, run and run_batch ignore it.
+	 * 
+	 * @param[in] mask	Bit k allows way k, all ones for every way.
+	 */
+	void set_way_mask(uint64_t mask)
+	{
+		way_mask = mask;
+	}
+
+	/*
+	 * Sets the prefetcher of the cache, the demand accesses train it and
+	 * the lines it returns are filled in the cache. The prefetched
+	 * lines aren't saved in checkpoints.
+	 * 
+	 * @param[in] p	Prefetcher, owned by the cache.
+	 */
+	void set_prefetcher(Prefetcher *p)
+	{
+		prefetcher.reset(p);
+		page_shift = page_line_shift(cache_b);
+		long lines = max((long)cache_s*1024/cache_b, 2L);
+		polluted.assign((size_t)1<<(64-__builtin_clzll(lines-1)), INVALID_TAG);
+	}
+
+	/*
+	 * Returns the prefetcher of the cache.
+	 * 
+	 * @returns Prefetcher*	Prefetcher, nullptr if the cache has none.
+	 */
+	Prefetcher* get_prefetcher()
+	{
+		return prefetcher.get();
+	}
+
+	/*
+	 * Returns the prefetch counters.
+	 * 
+	 * @returns PrefetchCounters	Counters of the prefetches.
+	 */
+	PrefetchCounters get_prefetch_counters()
+	{
+		return pf_cnt;
+	}
+
+	/*
+	 * Returns the block size of the cache.
+	 * 
+	 * @returns int	Block size in bytes.
+	 */
+	int get_block_size()
+	{
+		return cache_b;
+	}
+
+	/*
+	 * Retuns the M value of the SRRIP cache.
+	 * 
+	 * @returns int M value for SRRIP.
+	 */
+	int get_srrip_m()
+	{
+	return srrip_m;
+	}
+
+	/*
+	 * Returns the number of sets of the cache.
+	 * 
+	 * @returns int	Number of sets.
+	 */
+	int get_num_sets()
+	{
+		return num_sets;
+	}
+
+	/*
+	 * Returns the index bits of an address.
+	 * 
+	 * @param[in] phy_addr	Physical address.
+	 * @returns uint64_t	Index of the set of the address.
+	 */
+	uint64_t get_index(uint64_t phy_addr)
+	{
+		return bit_crop(phy_addr, tag_offset, index_offset);
+	}
+
+	/*
+	 * Returns access counter.
+	 * 
+	 * @returns uint64_t Access counter.
+	 */
+	uint64_t get_access_cnt()
+	{
+		return access_cnt;
+	}
+
+	/*
+	 * Returns read hit counter.
+	 * 
+	 * @returns uint64_t Read hit counter.
+	 */
+	uint64_t get_read_hit_cnt()
+	{
+		return read_hit_cnt;
+	}
+
+	/*
+	 * Returns the store hit counter.
+	 * 
+	 * @returns uint64_t Store hit counter.
+	 */
+	uint64_t get_store_hit_cnt()
+	{
+		return store_hit_cnt;
+	}
+
+	/*
+	 * Returns the misses counter.
+	 * 
+	 * @returns uint64_t Misses counter.
+	 */
+	uint64_t get_read_misses_cnt()
+	{
+		return read_misses_cnt;
+	}
+
+	/*
+	 * Returns the store misses counter.
+	 * 
+	 * @returns uint64_t Stores misses counter.
+	 */
+	uint64_t get_store_misses_cnt()
+	{
+		return store_misses_cnt;
+	}
+
+	/*
+	 * Returns the dirty evictions counter.
+	 * 
+	 * @returns uint64_t Dirty evictions counter.
+	 */
+	uint64_t get_dirty_evicts_cnt()
+	{
+		return dirty_evicts_cnt;
+	}
+
+	/*
+	 * Returns the values of all the counters.
+	 * 
+	 * @returns CacheCounters	Counters of the cache.
+	 */
+	CacheCounters get_counters()
+	{
+		CacheCounters c;
+		c.access = access_cnt;
+		c.read_hit = read_hit_cnt;
+		c.store_hit = store_hit_cnt;
+		c.read_misses = read_misses_cnt;
+		c.store_misses = store_misses_cnt;
+		c.dirty_evicts = dirty_evicts_cnt;
+		return c;
+	}
+
+	/*
+	 * Sets the values of all the counters.
+	 * 
+	 * @param[in] c	New values of the counters.
+	 */
+	void set_counters(const CacheCounters &c)
+	{
+		access_cnt = c.access;
+		read_hit_cnt = c.read_hit;
+		store_hit_cnt = c.store_hit;
+		read_misses_cnt = c.read_misses;
+		store_misses_cnt = c.store_misses;
+		dirty_evicts_cnt = c.dirty_evicts;
+	}
+
+	/*
+	 * Empties the cache, like a new one with the same configuration and
+	 * prefetcher: removes the lines, the state of the policy and of the
+	 * prefetcher and clears the counters.
+	 */
+	void clear()
+	{
+		clear_lines();
+		reset_counters();
+		if (prefetcher)
+		{
+			set_prefetcher(make_prefetcher(prefetcher->get_kind(), prefetcher->get_degree(), cache_b));
+			prefetched.clear();
+		}
+	}
+
+	/*
+	 * Clears the counters, the lines of the cache are kept.
+	 */
+	void reset_counters()
+	{
+		access_cnt = 0;
+		read_hit_cnt = 0;
+		store_hit_cnt = 0;
+		read_misses_cnt = 0;
+		store_misses_cnt = 0;
+		dirty_evicts_cnt = 0;
+		pf_cnt = PrefetchCounters();
+	}
+
+	/*
+	 * Adds the counters of another cache to the counters of this one,
+	 * used to reduce the results of the shards of a cache.
+	 * 
+	 * @param[in] o	Cache with the counters to add.
+	 */
+	void add_counters(const CacheModel &o)
+	{
+		access_cnt += o.access_cnt;
+		read_hit_cnt += o.read_hit_cnt;
+		store_hit_cnt += o.store_hit_cnt;
+		read_misses_cnt += o.read_misses_cnt;
+		store_misses_cnt += o.store_misses_cnt;
+		dirty_evicts_cnt += o.dirty_evicts_cnt;
+	}
+};
+
+
+// replacement policies selected from the command line
+enum PolicyKind
+{
+	POLICY_SRRIP,
+	POLICY_BRRIP,
+	POLICY_DRRIP,
+	POLICY_LRU,
+	POLICY_PLRU
+};
+
+// names of the replacement policies, by PolicyKind
+static const char *const policy_names[] = {"srrip", "brrip", "drrip", "lru", "plru"};
+
+
+/*
+ * Creates a cache for a geometry, the common associativities and block
+ * sizes use a specialized Cache and any other geometry uses the
+ * dynamic one. Building with -DCACHE_DYNAMIC_ONLY skips the
+ * specializations.
+ * 
+ * @param[in] s	Size of the cache in KB.
+ * @param[in] w	Numer of ways of the cache.
+ * @param[in] b	Block size of the cache.
+ * @param[in] policy	Replacement policy, a PolicyKind.
+ * @param[in] shift	Log2 of the shards the sets are split in.
+ * @returns CacheModel*	New cache.
+ */
+CacheModel* make_cache(int s, int w, int b, int policy=POLICY_SRRIP, int shift=0);
+
+/*
+ * Returns the replacement policy with the given name.
+ * 
+ * @param[in] name	Name of the policy, like "srrip".
+ * @returns int	PolicyKind of the policy, -1 if there is none.
+ */
+int parse_policy(const char *name);
+
+/*
+ * Parses a comma separated list of integers, like "16,32,64".
+ * 
+ * @param[in] str	List to parse.
+ * @returns vector<int>	Values of the list.
+ */
+vector<int> parse_list(const char *str);
+
+/*
+ * Parses a comma separated list of policy names, like "srrip,lru".
+ * 
+ * @param[in] str	List to parse.
+ * @returns vector<int>	Policies of the list, -1 for unknown names.
+ */
+vector<int> parse_policies(const char *str);
+
+/*
+ * Sets the max bytes of the lines of a cache that are allocated up
+ * front (256MB by default), the sets of bigger caches are created on
+ * demand and take memory for the sets touched only. Applies to the
+ * caches created after the call.
+ * 
+ * @param[in] bytes	Max bytes of a cache allocated up front.
+ */
+void set_dense_limit(uint64_t bytes);
+
+
+/*
+ * Source of the raw bytes of a trace.
+ */
+class ByteSource
+{
+public:
+	virtual ~ByteSource() {}
+
+	/*
+	 * Reads the next bytes of the trace.
+	 * 
+	 * @param[out] dst	Buffer for the data.
+	 * @param[in] n	Size of dst.
+	 * @returns long	Bytes read, 0 at the end of the trace and -1 on
+	 * 					errors.
+	 */
+	virtual long read(char *dst, size_t n) = 0;
+};
+
+/*
+ * Opens a trace file, the compression is selected from its extension:
+ * .zst files use zstd and any other file is read with zlib, which also
+ * takes uncompressed traces. The path "-" reads stdin.
+ * 
+ * @param[in] path	Path of the trace.
+ * @returns ByteSource*	Source of the trace, nullptr on errors.
+ */
+ByteSource* open_trace(const char *path);
+
+
+/*
+ * Source of decoded accesses that are consumed by batches.
+ */
+class AccessSource
+{
+public:
+	virtual ~AccessSource() {}
+
+	/*
+	 * Returns the next batch of accesses, the previous batch returned
+	 * is released and must not be used anymore.
+	 * 
+	 * @param[out] batch	Accesses of the batch.
+	 * @param[out] n	Number of accesses of the batch.
+	 * @returns bool	False at the end of the trace.
+	 */
+	virtual bool next(const Access *&batch, size_t &n) = 0;
+
+	/*
+	 * Skips accesses without decoding them, if the source can do it.
+	 * 
+	 * @param[in] n	Accesses to skip.
+	 * @returns uint64_t	Accesses skipped, the rest must be read.
+	 */
+	virtual uint64_t seek(uint64_t n)
+	{
+		return 0;
+	}
+};
+
+/*
+ * Window of the accesses of another source, skips the first accesses
+ * and stops after a max number of them.
+ */
+class TraceWindow : public AccessSource
+{
+private:
+	unique_ptr<AccessSource> source;	// accesses of the whole trace
+	uint64_t skip;	// accesses left to skip
+	uint64_t left;	// accesses left to return
+
+public:
+
+	/*
+	 * Inits a window of a source.
+	 * 
+	 * @param[in] s	Source, owned by the window.
+	 * @param[in] k	Accesses to skip.
+	 * @param[in] m	Max accesses to return, 0 for no limit.
+	 */
+	TraceWindow(AccessSource *s, uint64_t k, uint64_t m)
+		: source(s)
+	{
+		skip = k-source->seek(k);
+		left = m ? m : ~(uint64_t)0;
+	}
+
+	bool next(const Access *&batch, size_t &n)
+	{
+		if (left == 0)
+			return false;
+		do
+		{
+			if (!source->next(batch, n))
+				return false;
+			// skip the start of the batch
+			size_t k = min<uint64_t>(skip, n);
+			batch += k;
+			n -= k;
+			skip -= k;
+		}
+		while (n == 0);
+		n = min<uint64_t>(n, left);
+		left -= n;
+		return true;
+	}
+};
+
+/*
+ * Accesses kept by another program as separate arrays of addresses,
+ * types and instructions, like the columns of a trace loaded in
+ * memory. The arrays are not copied, each batch is decoded from them
+ * when it is read, so they must outlive the source.
+ */
+class ArraySource : public AccessSource
+{
+private:
+	const uint64_t *addrs;	// physical address of each access
+	const uint8_t *types;	// type of each access(0:load/else store), null if all are loads
+	const uint64_t *pcs;	// instruction of each access, may be null
+	size_t count;	// number of accesses
+	size_t pos;	// next access to decode
+	vector<Access> buf;	// batch decoded
+
+public:
+
+	/*
+	 * Inits a source over some arrays.
+	 * 
+	 * @param[in] a	Physical addresses of the accesses.
+	 * @param[in] t	Types of the accesses, or null.
+	 * @param[in] p	Instructions of the accesses, or null.
+	 * @param[in] n	Number of accesses.
+	 */
+	ArraySource(const uint64_t *a, const uint8_t *t, const uint64_t *p, size_t n)
+		: buf(min<size_t>(n, ACCESS_BATCH_SIZE))
+	{
+		addrs = a;
+		types = t;
+		pcs = p;
+		count = n;
+		pos = 0;
+	}
+
+	bool next(const Access *&batch, size_t &n)
+	{
+		if (pos == count)
+			return false;
+		n = min<size_t>(count-pos, buf.size());
+		for (size_t k=0; k<n; k++)
+		{
+			buf[k].ls = types ? types[pos+k] != 0 : 0;
+			buf[k].phy_addr = addrs[pos+k];
+			buf[k].pc = pcs ? pcs[pos+k] : 0;
+		}
+		pos += n;
+		batch = buf.data();
+		return true;
+	}
+
+	uint64_t seek(uint64_t n)
+	{
+		uint64_t k = min<uint64_t>(n, count-pos);
+		pos += k;
+		return k;
+	}
+};
+
+/*
+ * Periodic sample of the accesses of another source, of every period
+ * of the trace it fast-forwards over the start and returns the last
+ * accesses, the ones of the warmup and the detailed interval.
+ */
+class TraceSampler : public AccessSource
+{
+private:
+	unique_ptr<AccessSource> source;	// accesses of the whole trace
+	const Access *held;	// accesses of the batch of source not used yet
+	size_t held_n;	// number of accesses held
+	uint64_t gap;	// accesses to skip at the start of each period
+	uint64_t window;	// accesses to return of each period
+	uint64_t skip;	// accesses left to skip of this period
+	uint64_t left;	// accesses left to return of this period
+
+public:
+
+	/*
+	 * Inits a sample of a source.
+	 * 
+	 * @param[in] s	Source, owned by the sampler.
+	 * @param[in] period	Accesses of each period.
+	 * @param[in] w	Accesses returned of each period.
+	 */
+	TraceSampler(AccessSource *s, uint64_t period, uint64_t w)
+		: source(s)
+	{
+		held = nullptr;
+		held_n = 0;
+		gap = period-w;
+		window = w;
+		skip = gap;
+		left = window;
+	}
+
+	bool next(const Access *&batch, size_t &n)
+	{
+		while (1)
+		{
+			if (held_n == 0)
+			{
+				// fast-forward without decoding if the source can
+				skip -= source->seek(skip);
+				if (!source->next(held, held_n))
+					return false;
+			}
+			size_t k = min<uint64_t>(skip, held_n);
+			held += k;
+			held_n -= k;
+			skip -= k;
+			if (held_n > 0)
+				break;
+		}
+		n = min<uint64_t>(held_n, left);
+		batch = held;
+		held += n;
+		held_n -= n;
+		left -= n;
+		if (left == 0)
+		{
+			// next period
+			skip = gap;
+			left = window;
+		}
+		return true;
+	}
+};
+
+/*
+ * Decodes a text trace on a producer thread, while the caller consumes
+ * the batches already decoded.
+ * 
+ * @param[in] src	Raw data of the trace, owned by the source returned.
+ * @returns AccessSource*	Accesses of the trace.
+ */
+AccessSource* open_text_accesses(ByteSource *src);
+
+/*
+ * Opens a trace for the simulation, binary traces are mapped in memory
+ * and text traces are decoded by a ThreadedTraceReader.
+ * 
+ * @param[in] path	Path of the trace, "-" reads a text trace from stdin.
+ * @returns AccessSource*	Accesses of the trace, nullptr on errors.
+ */
+AccessSource* open_accesses(const char *path);
+
+// patterns of the synthetic traces
+enum SyntheticKind
+{
+	SYNTH_SEQ,
+	SYNTH_STRIDE,
+	SYNTH_RANDOM,
+	SYNTH_ZIPF,
+	SYNTH_CHASE
+};
+
+// names of the synthetic patterns, in SyntheticKind order
+static const char *const synthetic_names[] = {"seq", "stride", "random", "zipf", "chase"};
+
+// parameters of a synthetic trace
+struct SyntheticConfig
+{
+	int kind;	// pattern of the addresses, a SyntheticKind
+	uint64_t accesses;	// number of accesses
+	uint64_t footprint;	// bytes of the working set
+	uint64_t stride;	// bytes between accesses of seq and stride
+	int streams;	// interleaved streams of seq and stride
+	uint64_t item;	// bytes of the items of zipf and chase
+	double alpha;	// exponent of zipf
+	double stores;	// fraction of stores
+	uint64_t seed;	// seed of the random numbers
+};
+
+/*
+ * Returns the default parameters of a synthetic pattern: 10M accesses
+ * over 64MB, 8 byte steps for seq and 4KB for stride, a single stream,
+ * 64 byte items, alpha 0.99 and a quarter of stores.
+ * 
+ * @param[in] kind	Pattern, a SyntheticKind.
+ * @returns SyntheticConfig	Parameters of the pattern.
+ */
+SyntheticConfig synthetic_defaults(int kind);
+
+/*
+ * Checks that a synthetic trace can be generated, printing the error.
+ * 
+ * @param[in] cfg	Parameters of the trace.
+ * @returns bool	True if the parameters are valid.
+ */
+bool check_synthetic(const SyntheticConfig &cfg);
+
+/*
+ * Generates the accesses of a synthetic pattern, always the same ones
+ * for the same parameters, with no file behind them:
+ * seq and stride walk the working set with a fixed step, in streams
+ * that start at equally spaced positions and take turns, random picks
+ * uniform 8 byte words, zipf picks items with a Zipf distribution of
+ * the given exponent and chase follows a pseudo random cycle through
+ * all the items, like a linked list spread over the working set.
+ * 
+ * @param[in] cfg	Parameters of the trace, checked by check_synthetic.
+ * @returns AccessSource*	Accesses of the trace.
+ */
+AccessSource* open_synthetic(const SyntheticConfig &cfg);
+
+/*
+ * Converts a text trace to the binary trace format.
+ * 
+ * @param[in] trace	Accesses of the text trace.
+ * @param[in] path	Path of the binary trace.
+ * @param[in] delta	Use delta encoded records.
+ * @returns int	Exit status of the program.
+ */
+int convert_trace(AccessSource *trace, const char *path, bool delta);
+
+
+// geometry of a simulated cache
+struct CacheConfig
+{
+	int size;	// cache size in KB
+	int ways;	// cache associativity
+	int block;	// cache block size in bytes
+	int policy;	// replacement policy, a PolicyKind
+};
+
+/*
+ * Creates a cache for a configuration.
+ * 
+ * @param[in] cfg	Configuration of the cache.
+ * @returns CacheModel*	New cache, owned by the caller.
+ */
+inline CacheModel* make_cache(const CacheConfig &cfg)
+{
+	return make_cache(cfg.size, cfg.ways, cfg.block, cfg.policy);
+}
+
+// costs of a cache or a level of a hierarchy in cycles
+struct LatencyConfig
+{
+	int hit;	// latency of a hit
+	int miss;	// penalty of a miss, besides the latency of the levels below
+	int writeback;	// cost of writing back a modified line
+};
+
+// cumulative counters of a cache at the end of an interval
+struct IntervalSample
+{
+	size_t config;	// configuration of the cache
+	uint64_t accesses;	// accesses of the trace up to the end of the interval
+	uint64_t read_misses;	// read misses up to the end of the interval
+	uint64_t store_misses;	// store misses up to the end of the interval
+	uint64_t dirty_evicts;	// dirty evictions up to the end of the interval
+};
+
+/*
+ * Lock free single producer single consumer ring of interval samples,
+ * the producer only waits if the writer falls a whole ring behind.
+ */
+class StatsRing
+{
+private:
+	vector<IntervalSample> slots;	// samples of the ring
+	atomic<size_t> head;	// next sample to pop
+	atomic<size_t> tail;	// next sample to push
+
+public:
+	StatsRing() : slots(STATS_RING_SLOTS), head(0), tail(0)
+	{
+	}
+
+	/*
+	 * Adds a sample to the ring.
+	 * 
+	 * @param[in] s	Sample to add.
+	 */
+	void push(const IntervalSample &s)
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		while (t-head.load(memory_order_acquire) >= STATS_RING_SLOTS)
+			this_thread::yield();
+		slots[t%STATS_RING_SLOTS] = s;
+		tail.store(t+1, memory_order_release);
+	}
+
+	/*
+	 * Removes the oldest sample of the ring.
+	 * 
+	 * @param[out] s	Removed sample.
+	 * @returns bool	False if the ring was empty.
+	 */
+	bool pop(IntervalSample &s)
+	{
+		size_t h = head.load(memory_order_relaxed);
+		if (tail.load(memory_order_acquire) == h)
+			return false;
+		s = slots[h%STATS_RING_SLOTS];
+		head.store(h+1, memory_order_release);
+		return true;
+	}
+};
+
+/*
+ * Writes a snapshot of the counters of every cache each N accesses, as
+ * CSV or JSON lines. The simulation threads push samples to their own
+ * StatsRing and a writer thread formats them, so the I/O never runs in
+ * the simulation loop. When a cache is split in shards each shard
+ * pushes its part of the counters and the writer adds them up.
+ */
+class IntervalLog
+{
+private:
+	vector<unique_ptr<StatsRing>> rings;	// samples of each producer
+	vector<string> labels;	// name of each configuration
+	vector<IntervalSample> last;	// last sample written of each configuration
+	map<pair<size_t,uint64_t>, pair<int,IntervalSample>> partial;	// samples with parts missing
+	uint64_t interval;	// accesses of each interval
+	int parts;	// producers that share each sample
+	FILE *out;	// output stream
+	bool json;	// write JSON lines instead of CSV
+	atomic<bool> done;	// the simulation finished
+	thread writer;	// thread that writes the samples
+
+	/*
+	 * Writes a complete sample.
+	 * 
+	 * @param[in] s	Sample to write.
+	 */
+	void write(const IntervalSample &s)
+	{
+		IntervalSample &prev = last[s.config];
+		uint64_t n = s.accesses-prev.accesses;
+		double interval_miss = n ? (double)(s.read_misses+s.store_misses-
+			prev.read_misses-prev.store_misses)/n : 0.0;
+		double interval_read_miss = n ? (double)(s.read_misses-prev.read_misses)/n : 0.0;
+		uint64_t interval_dirty = s.dirty_evicts-prev.dirty_evicts;
+		double miss = s.accesses ? (double)(s.read_misses+s.store_misses)/s.accesses : 0.0;
+		double read_miss = s.accesses ? (double)s.read_misses/s.accesses : 0.0;
+		if (json)
+		{
+			fprintf(out, "{\"config\":\"%s\",\"accesses\":%" PRIu64 ","
+				"\"interval_miss_rate\":%.6f,\"interval_read_miss_rate\":%.6f,"
+				"\"interval_dirty_evictions\":%" PRIu64 ",\"miss_rate\":%.6f,"
+				"\"read_miss_rate\":%.6f,\"dirty_evictions\":%" PRIu64 "}\n",
+				labels[s.config].c_str(), s.accesses, interval_miss,
+				interval_read_miss, interval_dirty, miss, read_miss, s.dirty_evicts);
+		}
+		else
+		{
+			fprintf(out, "%s,%" PRIu64 ",%.6f,%.6f,%" PRIu64 ",%.6f,%.6f,%" PRIu64 "\n",
+				labels[s.config].c_str(), s.accesses, interval_miss,
+				interval_read_miss, interval_dirty, miss, read_miss, s.dirty_evicts);
+		}
+		prev = s;
+	}
+
+	/*
+	 * Writes the samples in the rings.
+	 * 
+	 * @returns bool	False if the rings were empty.
+	 */
+	bool drain()
+	{
+		bool any = false;
+		IntervalSample s;
+		for (unique_ptr<StatsRing> &ring : rings)
+		{
+			while (ring->pop(s))
+			{
+				any = true;
+				if (parts == 1)
+				{
+					write(s);
+					continue;
+				}
+				// add the part to the other parts of the same sample
+				pair<int,IntervalSample> &p = partial[make_pair(s.config, s.accesses)];
+				if (p.first == 0)
+				{
+					p.second = s;
+				}
+				else
+				{
+					p.second.read_misses += s.read_misses;
+					p.second.store_misses += s.store_misses;
+					p.second.dirty_evicts += s.dirty_evicts;
+				}
+				if (++p.first == parts)
+				{
+					write(p.second);
+					partial.erase(make_pair(s.config, s.accesses));
+				}
+			}
+		}
+		return any;
+	}
+
+public:
+
+	/*
+	 * Inits the log and starts the writer thread.
+	 * 
+	 * @param[in] cfgs	Configurations of the caches.
+	 * @param[in] producers	Threads that push samples.
+	 * @param[in] p	Producers that push a part of each sample.
+	 * @param[in] n	Accesses of each interval.
+	 * @param[in] o	Output stream.
+	 * @param[in] j	Write JSON lines instead of CSV.
+	 */
+	IntervalLog(const vector<CacheConfig> &cfgs, int producers, int p, uint64_t n, FILE *o, bool j)
+		: last(cfgs.size(), IntervalSample()), done(false)
+	{
+		for (int k=0; k<producers; k++)
+			rings.emplace_back(new StatsRing());
+		for (const CacheConfig &cfg : cfgs)
+		{
+			labels.push_back(to_string(cfg.size)+":"+to_string(cfg.ways)+":"+
+				to_string(cfg.block)+":"+policy_names[cfg.policy]);
+		}
+		parts = p;
+		interval = n;
+		out = o;
+		json = j;
+		if (!json)
+		{
+			fprintf(out, "config,accesses,interval_miss_rate,interval_read_miss_rate,"
+				"interval_dirty_evictions,miss_rate,read_miss_rate,dirty_evictions\n");
+		}
+		writer = thread([this] {
+			while (!done.load(memory_order_acquire))
+			{
+				if (!drain())
+					this_thread::sleep_for(chrono::milliseconds(1));
+			}
+			drain();
+		});
+	}
+
+	~IntervalLog()
+	{
+		finish();
+	}
+
+	/*
+	 * Returns the accesses of each interval.
+	 * 
+	 * @returns uint64_t	Interval length.
+	 */
+	uint64_t get_interval()
+	{
+		return interval;
+	}
+
+	/*
+	 * Returns the accesses left to the end of the current interval.
+	 * 
+	 * @param[in] accesses	Accesses run so far.
+	 * @returns uint64_t	Accesses to the next snapshot.
+	 */
+	uint64_t until_snapshot(uint64_t accesses)
+	{
+		return interval-accesses%interval;
+	}
+
+	/*
+	 * Takes a snapshot of the counters of a cache.
+	 * 
+	 * @param[in] producer	Thread that takes the snapshot.
+	 * @param[in] config	Configuration of the cache.
+	 * @param[in] cache	Cache, or shard of the cache.
+	 * @param[in] accesses	Accesses of the trace run so far.
+	 */
+	void record(int producer, size_t config, CacheModel &cache, uint64_t accesses)
+	{
+		IntervalSample s;
+		s.config = config;
+		s.accesses = accesses;
+		s.read_misses = cache.get_read_misses_cnt();
+		s.store_misses = cache.get_store_misses_cnt();
+		s.dirty_evicts = cache.get_dirty_evicts_cnt();
+		rings[producer]->push(s);
+	}
+
+	/*
+	 * Writes the pending samples and stops the writer thread.
+	 */
+	void finish()
+	{
+		if (writer.joinable())
+		{
+			done.store(true, memory_order_release);
+			writer.join();
+			fflush(out);
+		}
+	}
+};
+
+// estimate of the miss rate of a cache from sampled intervals
+struct SampleStats
+{
+	uint64_t count;	// detailed intervals simulated
+	double sum;	// sum of the miss rates of the intervals
+	double sum_sq;	// sum of the squared miss rates
+	CacheCounters total;	// counters of all the detailed intervals
+};
+
+/*
+ * Ring of chunks of decoded accesses shared by the workers of a parallel
+ * sweep. A chunk is immutable once published, and its slot is reused
+ * after all the workers released it.
+ */
+class SharedChunks
+{
+private:
+	vector<vector<Access>> chunks;	// accesses of each slot
+	vector<size_t> sizes;	// accesses in each slot
+	vector<int> pending;	// workers that didn't release each slot
+	int readers;	// number of workers
+	long published;	// chunks published
+	bool done;	// no more chunks will be published
+	mutex mtx;	// protects the ring state
+	condition_variable cv;	// signals changes of the ring state
+
+public:
+
+	/*
+	 * Inits an empty ring.
+	 * 
+	 * @param[in] r	Number of workers that read every chunk.
+	 */
+	SharedChunks(int r)
+		: chunks(SHARED_CHUNKS, vector<Access>(ACCESS_BATCH_SIZE)),
+		  sizes(SHARED_CHUNKS, 0), pending(SHARED_CHUNKS, 0)
+	{
+		readers = r;
+		published = 0;
+		done = false;
+	}
+
+	/*
+	 * Copies a batch of accesses to the next chunk, waits until its slot
+	 * is released by all the workers.
+	 * 
+	 * @param[in] batch	Accesses to publish.
+	 * @param[in] n	Number of accesses, at most ACCESS_BATCH_SIZE.
+	 */
+	void publish(const Access *batch, size_t n)
+	{
+		long slot = published%SHARED_CHUNKS;
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [this, slot]{ return pending[slot] == 0; });
+		}
+		copy(batch, batch+n, chunks[slot].begin());
+		{
+			lock_guard<mutex> lock(mtx);
+			sizes[slot] = n;
+			pending[slot] = readers;
+			published++;
+		}
+		cv.notify_all();
+	}
+
+	/*
+	 * Marks the end of the chunks.
+	 */
+	void finish()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			done = true;
+		}
+		cv.notify_all();
+	}
+
+	/*
+	 * Waits for a chunk of accesses.
+	 * 
+	 * @param[in] seq	Number of the chunk.
+	 * @param[out] batch	Accesses of the chunk.
+	 * @param[out] n	Number of accesses of the chunk.
+	 * @returns bool	False if there is no such chunk.
+	 */
+	bool get(long seq, const Access *&batch, size_t &n)
+	{
+		unique_lock<mutex> lock(mtx);
+		cv.wait(lock, [this, seq]{ return done || published > seq; });
+		if (published <= seq)
+			return false;
+		batch = chunks[seq%SHARED_CHUNKS].data();
+		n = sizes[seq%SHARED_CHUNKS];
+		return true;
+	}
+
+	/*
+	 * Releases a chunk read by a worker.
+	 * 
+	 * @param[in] seq	Number of the chunk.
+	 */
+	void release(long seq)
+	{
+		bool last;
+		{
+			lock_guard<mutex> lock(mtx);
+			last = (--pending[seq%SHARED_CHUNKS] == 0);
+		}
+		if (last)
+			cv.notify_all();
+	}
+};
+
+/*
+ * Simulates several cache configurations in a single pass over a trace,
+ * every batch of decoded accesses is run through all the caches. The
+ * caches may be split across a pool of threads, each cache is only
+ * used by one thread so they don't need locks.
+ */
+class Sweep
+{
+private:
+	vector<CacheConfig> configs;	// simulated configurations
+	vector<unique_ptr<CacheModel>> caches;	// cache of each configuration
+	IntervalLog *log;	// snapshots of the counters, may be null
+	uint64_t warmup;	// accesses run before counting
+	uint64_t sample_warmup;	// accesses of the warmup of each sample
+	uint64_t sample_detail;	// accesses of each sample, 0 if not sampling
+	vector<SampleStats> samples;	// sampled estimate of each cache
+	uint64_t consumed;	// accesses read from the trace
+
+	/*
+	 * Runs a batch of the accesses of a sampled trace in some of the
+	 * caches, the trace has the warmup and the detailed interval of
+	 * each sample back to back.
+	 * 
+	 * @param[in] ids	Caches to use.
+	 * @param[in] batch	Accesses to run.
+	 * @param[in] n	Number of accesses.
+	 * @param[in] first	Position of the batch in the sampled trace.
+	 */
+	void run_sampled(const vector<size_t> &ids, const Access *batch, size_t n, uint64_t first)
+	{
+		uint64_t block = sample_warmup+sample_detail;
+		while (n > 0)
+		{
+			uint64_t r = first%block;
+			bool warm = r < sample_warmup;
+			size_t m = min<uint64_t>(n, (warm ? sample_warmup : block)-r);
+			for (size_t c : ids)
+			{
+				caches[c]->run_batch(batch, m);
+				if (warm && r+m == sample_warmup)
+				{
+					// the sample starts
+					caches[c]->reset_counters();
+				}
+				else if (!warm && r+m == block)
+				{
+					// the sample ends
+					CacheCounters cnt = caches[c]->get_counters();
+					double rate = (double)(cnt.read_misses+cnt.store_misses)/cnt.access;
+					SampleStats &st = samples[c];
+					st.count++;
+					st.sum += rate;
+					st.sum_sq += rate*rate;
+					st.total.access += cnt.access;
+					st.total.read_hit += cnt.read_hit;
+					st.total.store_hit += cnt.store_hit;
+					st.total.read_misses += cnt.read_misses;
+					st.total.store_misses += cnt.store_misses;
+					st.total.dirty_evicts += cnt.dirty_evicts;
+				}
+			}
+			batch += m;
+			n -= m;
+			first += m;
+		}
+	}
+
+	/*
+	 * Runs a batch of accesses in some of the caches.
+	 * 
+	 * @param[in] ids	Caches to use.
+	 * @param[in] batch	Accesses to run.
+	 * @param[in] n	Number of accesses.
+	 * @param[in] first	Position of the batch in the trace.
+	 * @param[in] worker	Thread that runs the batch.
+	 */
+	void run_batch(const vector<size_t> &ids, const Access *batch, size_t n,
+		uint64_t first, int worker)
+	{
+		if (sample_detail > 0)
+		{
+			run_sampled(ids, batch, n, first);
+			return;
+		}
+		if (first < warmup)
+		{
+			// the counters start at the end of the warmup
+			size_t m = min<uint64_t>(n, warmup-first);
+			for (size_t c : ids)
+			{
+				caches[c]->run_batch(batch, m);
+				if (first+m == warmup)
+					caches[c]->reset_counters();
+			}
+			batch += m;
+			n -= m;
+		}
+		for (size_t c : ids)
+		{
+			if (log == nullptr)
+			{
+				caches[c]->run_batch(batch, n);
+				continue;
+			}
+			// stop at the end of every interval to take a snapshot
+			CacheModel &cache = *caches[c];
+			size_t k = 0;
+			while (k < n)
+			{
+				size_t m = min<uint64_t>(n-k, log->until_snapshot(cache.get_access_cnt()));
+				cache.run_batch(batch+k, m);
+				k += m;
+				if (cache.get_access_cnt()%log->get_interval() == 0)
+					log->record(worker, c, cache, cache.get_access_cnt());
+			}
+		}
+	}
+
+	/*
+	 * Splits the caches between the workers, the cost of a cache is
+	 * estimated by its associativity and each cache goes to the worker
+	 * with the lowest load, starting with the most expensive ones.
+	 * 
+	 * @param[in] workers	Number of workers.
+	 * @returns vector<vector<size_t>>	Caches of each worker.
+	 */
+	vector<vector<size_t>> balance(int workers)
+	{
+		vector<size_t> order(configs.size());
+		for (size_t k=0; k<order.size(); k++)
+			order[k] = k;
+		sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			return configs[a].ways > configs[b].ways;
+		});
+		vector<vector<size_t>> assigned(workers);
+		vector<long> load(workers, 0);
+		for (size_t c : order)
+		{
+			int w = min_element(load.begin(), load.end())-load.begin();
+			assigned[w].push_back(c);
+			// fixed cost per access plus the search of the ways
+			load[w] += 16+configs[c].ways;
+		}
+		// keep the order of the configurations inside each worker
+		for (vector<size_t> &ids : assigned)
+			sort(ids.begin(), ids.end());
+		return assigned;
+	}
+
+public:
+
+	/*
+	 * Inits a cache for each configuration.
+	 * 
+	 * @param[in] c	Configurations to simulate.
+	 */
+	Sweep(const vector<CacheConfig> &c)
+	{
+		configs = c;
+		log = nullptr;
+		warmup = 0;
+		sample_warmup = 0;
+		sample_detail = 0;
+		consumed = 0;
+		for (size_t k=0; k<configs.size(); k++)
+		{
+			caches.emplace_back(make_cache(configs[k].size,
+				configs[k].ways, configs[k].block, configs[k].policy));
+		}
+	}
+
+	/*
+	 * Runs all the accesses of a trace.
+	 * 
+	 * @param[in] trace	Accesses of the trace.
+	 * @param[in] threads	Number of worker threads.
+	 * @param[in] l	Log for snapshots of the counters, with a ring for
+	 * 				each thread, or null.
+	 */
+	void run(AccessSource *trace, int threads, IntervalLog *l = nullptr)
+	{
+		const Access *batch;
+		size_t batch_size;
+		int workers = min<size_t>(threads, caches.size());
+		vector<vector<size_t>> assigned = balance(max(workers, 1));
+		log = l;
+		if (workers <= 1)
+		{
+			while (trace->next(batch, batch_size))
+			{
+				run_batch(assigned[0], batch, batch_size, consumed, 0);
+				consumed += batch_size;
+			}
+		}
+		else
+		{
+			// the workers read the chunks published by this thread
+			SharedChunks chunks(workers);
+			vector<thread> pool;
+			for (int w=0; w<workers; w++)
+			{
+				pool.emplace_back([this, &chunks, &assigned, w] {
+					const Access *chunk;
+					size_t chunk_size;
+					uint64_t first = 0;
+					for (long seq=0; chunks.get(seq, chunk, chunk_size); seq++)
+					{
+						run_batch(assigned[w], chunk, chunk_size, first, w);
+						first += chunk_size;
+						chunks.release(seq);
+					}
+				});
+			}
+			while (trace->next(batch, batch_size))
+			{
+				chunks.publish(batch, batch_size);
+				consumed += batch_size;
+			}
+			chunks.finish();
+			for (thread &t : pool)
+				t.join();
+		}
+
+		// the results of a sampled run are the detailed intervals, a
+		// last partial one is dropped
+		for (size_t c=0; sample_detail > 0 && c<caches.size(); c++)
+		{
+			caches[c]->set_counters(samples[c].total);
+		}
+
+		// snapshot of the last partial interval, the workers are done
+		// so this thread can use the first ring
+		for (size_t c=0; log != nullptr && c<caches.size(); c++)
+		{
+			uint64_t accesses = caches[c]->get_access_cnt();
+			if (accesses%log->get_interval() != 0)
+				log->record(0, c, *caches[c], accesses);
+		}
+	}
+
+	/*
+	 * Sets the accesses run before the counters start.
+	 * 
+	 * @param[in] n	Accesses of the warmup.
+	 */
+	void set_warmup(uint64_t n)
+	{
+		warmup = n;
+	}
+
+	/*
+	 * Adds a prefetcher to each cache.
+	 * 
+	 * @param[in] kind	Prefetcher, a PrefetchKind.
+	 * @param[in] degree	Lines prefetched ahead of each trigger.
+	 */
+	void set_prefetch(int kind, int degree)
+	{
+		for (size_t k=0; k<caches.size(); k++)
+		{
+			caches[k]->set_prefetcher(make_prefetcher(kind, degree, configs[k].block));
+		}
+	}
+
+	/*
+	 * Runs a sampled trace, the results are the counters of the
+	 * detailed intervals and an estimate of the miss rate.
+	 * 
+	 * @param[in] w	Accesses of the warmup before each sample.
+	 * @param[in] d	Accesses of each sample.
+	 */
+	void set_sampling(uint64_t w, uint64_t d)
+	{
+		sample_warmup = w;
+		sample_detail = d;
+		samples.assign(caches.size(), SampleStats());
+	}
+
+	/*
+	 * Returns the accesses read from the trace by run.
+	 * 
+	 * @returns uint64_t	Accesses read.
+	 */
+	uint64_t get_consumed()
+	{
+		return consumed;
+	}
+
+	/*
+	 * Returns the sampled estimate of a cache.
+	 * 
+	 * @param[in] k	Number of the configuration.
+	 * @returns SampleStats&	Estimate of the cache.
+	 */
+	const SampleStats& get_samples(size_t k)
+	{
+		return samples[k];
+	}
+
+	/*
+	 * Returns the number of configurations.
+	 * 
+	 * @returns size_t	Number of configurations.
+	 */
+	size_t size()
+	{
+		return configs.size();
+	}
+
+	/*
+	 * Returns a configuration.
+	 * 
+	 * @param[in] k	Number of the configuration.
+	 * @returns CacheConfig&	Configuration k.
+	 */
+	const CacheConfig& get_config(size_t k)
+	{
+		return configs[k];
+	}
+
+	/*
+	 * Returns the cache of a configuration.
+	 * 
+	 * @param[in] k	Number of the configuration.
+	 * @returns CacheModel&	Cache of configuration k.
+	 */
+	CacheModel& get_cache(size_t k)
+	{
+		return *caches[k];
+	}
+};
+
+
+/*
+ * Checks that a configuration can be simulated.
+ * 
+ * @param[in] cfg	Configuration to check.
+ * @param[out] error	Reason the configuration is not valid.
+ * @returns bool	True if the configuration is valid.
+ */
+bool check_config(const CacheConfig &cfg, string &error);
+
+/*
+ * Writes the state of the caches of a sweep to a checkpoint.
+ * 
+ * @param[in] path	Path of the checkpoint.
+ * @param[in] sweep	Sweep with the caches.
+ * @param[in] offset	Accesses of the trace run so far.
+ * @returns bool	False on errors.
+ */
+bool save_checkpoint(const char *path, Sweep &sweep, uint64_t offset);
+
+/*
+ * Opens a checkpoint and reads the configurations of its caches.
+ * 
+ * @param[in] path	Path of the checkpoint.
+ * @param[out] configs	Configurations of the caches.
+ * @param[out] offset	Accesses of the trace run before the checkpoint.
+ * @returns FILE*	Checkpoint positioned at the state of the caches,
+ * 					nullptr on errors.
+ */
+FILE* open_checkpoint(const char *path, vector<CacheConfig> &configs, uint64_t &offset);
+
+/*
+ * Restores the caches of a sweep from a checkpoint opened by
+ * open_checkpoint, the sweep must have the configurations read.
+ * 
+ * @param[in] f	Checkpoint, it is closed.
+ * @param[in] sweep	Sweep with the caches.
+ * @returns bool	False if the checkpoint is not valid.
+ */
+bool load_checkpoint(FILE *f, Sweep &sweep);
+
+/*
+ * Lock free single producer single consumer queue of batches of
+ * accesses. The producer fills the batch of a free slot in place and
+ * commits it, the consumer runs the batch in place and pops it.
+ */
+class ShardQueue
+{
+private:
+	vector<vector<Access>> slots;	// batches of the queue
+	vector<size_t> sizes;	// accesses of each batch
+	vector<uint64_t> marks;	// accesses of the trace to snapshot after each batch, or 0
+	vector<char> resets;	// clear the counters after each batch
+	atomic<size_t> head;	// next batch to pop
+	atomic<size_t> tail;	// next batch to commit
+	atomic<bool> closed;	// no more batches will be committed
+
+public:
+	ShardQueue()
+		: slots(SHARD_QUEUE_SLOTS, vector<Access>(SHARD_BATCH_SIZE)),
+		  sizes(SHARD_QUEUE_SLOTS, 0), marks(SHARD_QUEUE_SLOTS, 0),
+		  resets(SHARD_QUEUE_SLOTS, 0),
+		  head(0), tail(0), closed(false)
+	{
+	}
+
+	/*
+	 * Waits for a free slot and returns its batch to be filled.
+	 * 
+	 * @returns Access*	Batch of SHARD_BATCH_SIZE accesses.
+	 */
+	Access* reserve()
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		while (t-head.load(memory_order_acquire) >= SHARD_QUEUE_SLOTS)
+			this_thread::yield();
+		return slots[t%SHARD_QUEUE_SLOTS].data();
+	}
+
+	/*
+	 * Publishes the batch reserved.
+	 * 
+	 * @param[in] n	Number of accesses in the batch.
+	 * @param[in] mark	Accesses of the trace run at the end of the
+	 * 					batch if the shard must take a snapshot, or 0.
+	 * @param[in] reset	Clear the counters after the batch.
+	 */
+	void commit(size_t n, uint64_t mark = 0, bool reset = false)
+	{
+		size_t t = tail.load(memory_order_relaxed);
+		sizes[t%SHARD_QUEUE_SLOTS] = n;
+		marks[t%SHARD_QUEUE_SLOTS] = mark;
+		resets[t%SHARD_QUEUE_SLOTS] = reset;
+		tail.store(t+1, memory_order_release);
+	}
+
+	/*
+	 * Marks the end of the batches.
+	 */
+	void close()
+	{
+		closed.store(true, memory_order_release);
+	}
+
+	/*
+	 * Waits for the next batch.
+	 * 
+	 * @param[out] batch	Accesses of the batch.
+	 * @param[out] n	Number of accesses of the batch.
+	 * @param[out] mark	Snapshot to take after the batch, or 0.
+	 * @param[out] reset	Clear the counters after the batch.
+	 * @returns bool	False if the queue is closed and empty.
+	 */
+	bool front(const Access *&batch, size_t &n, uint64_t &mark, bool &reset)
+	{
+		size_t h = head.load(memory_order_relaxed);
+		while (tail.load(memory_order_acquire) == h)
+		{
+			if (closed.load(memory_order_acquire) &&
+				tail.load(memory_order_acquire) == h)
+				return false;
+			this_thread::yield();
+		}
+		batch = slots[h%SHARD_QUEUE_SLOTS].data();
+		n = sizes[h%SHARD_QUEUE_SLOTS];
+		mark = marks[h%SHARD_QUEUE_SLOTS];
+		reset = resets[h%SHARD_QUEUE_SLOTS];
+		return true;
+	}
+
+	/*
+	 * Releases the batch returned by front.
+	 */
+	void pop()
+	{
+		head.store(head.load(memory_order_relaxed)+1, memory_order_release);
+	}
+};
+
+/*
+ * Simulates a single cache with its sets split in shards, each one run
+ * by its own thread. With the policies that keep no state across sets,
+ * running the accesses of every set in the trace order gives the same
+ * results as the sequential simulation. DRRIP isn't supported, its
+ * PSEL counter is shared by all the sets. A dispatcher routes each
+ * access by its set index to the queue of its shard.
+ */
+class ShardedCache
+{
+private:
+	vector<unique_ptr<CacheModel>> shards;	// cache of each shard
+	vector<unique_ptr<ShardQueue>> queues;	// accesses of each shard
+	uint64_t warmup;	// accesses run before counting
+
+public:
+
+	/*
+	 * Inits the caches of the shards.
+	 * 
+	 * @param[in] cfg	Configuration of the cache.
+	 * @param[in] n	Max number of shards, the cache uses the largest
+	 * 				power of two up to n and the number of sets.
+	 * @throws invalid_argument	The policy is DRRIP.
+	 */
+	ShardedCache(const CacheConfig &cfg, int n)
+	{
+		if (cfg.policy == POLICY_DRRIP)
+			throw invalid_argument("sharded caches don't support drrip");
+		long num_sets = (long)cfg.size*1024/((long)cfg.ways*cfg.block);
+		int shift = 0;
+		while ((2<<shift) <= n && (2<<shift) <= num_sets)
+			shift++;
+		for (int k=0; k<(1<<shift); k++)
+		{
+			shards.emplace_back(make_cache(cfg.size, cfg.ways, cfg.block, cfg.policy, shift));
+			queues.emplace_back(new ShardQueue());
+		}
+		warmup = 0;
+	}
+
+	/*
+	 * Sets the accesses run before the counters start.
+	 * 
+	 * @param[in] n	Accesses of the warmup.
+	 */
+	void set_warmup(uint64_t n)
+	{
+		warmup = n;
+	}
+
+	/*
+	 * Runs all the accesses of a trace.
+	 * 
+	 * @param[in] trace	Accesses of the trace.
+	 * @param[in] log	Log for snapshots of the counters, with a ring
+	 * 					for each shard, or null.
+	 */
+	void run(AccessSource *trace, IntervalLog *log = nullptr)
+	{
+		size_t n = shards.size();
+		vector<thread> pool;
+		for (size_t k=0; k<n; k++)
+		{
+			pool.emplace_back([this, k, log] {
+				const Access *batch;
+				size_t batch_size;
+				uint64_t mark;
+				bool reset;
+				while (queues[k]->front(batch, batch_size, mark, reset))
+				{
+					shards[k]->run_batch(batch, batch_size);
+					queues[k]->pop();
+					if (reset)
+						shards[k]->reset_counters();
+					if (mark != 0)
+						log->record(k, 0, *shards[k], mark);
+				}
+			});
+		}
+
+		// route the accesses to the shards
+		vector<Access*> out(n);
+		vector<size_t> fill(n, 0);
+		for (size_t k=0; k<n; k++)
+			out[k] = queues[k]->reserve();
+		CacheModel &router = *shards[0];
+		const Access *batch;
+		size_t batch_size;
+		uint64_t seen = 0;
+		uint64_t accesses = 0;
+		while (trace->next(batch, batch_size))
+		{
+			for (size_t i=0; i<batch_size; i++)
+			{
+				size_t k = router.get_index(batch[i].phy_addr)&(n-1);
+				out[k][fill[k]++] = batch[i];
+				if (fill[k] == SHARD_BATCH_SIZE)
+				{
+					queues[k]->commit(fill[k]);
+					out[k] = queues[k]->reserve();
+					fill[k] = 0;
+				}
+				if (++seen <= warmup)
+				{
+					if (seen == warmup)
+					{
+						// every shard starts counting here
+						for (size_t j=0; j<n; j++)
+						{
+							queues[j]->commit(fill[j], 0, true);
+							out[j] = queues[j]->reserve();
+							fill[j] = 0;
+						}
+					}
+					continue;
+				}
+				if (log != nullptr && ++accesses%log->get_interval() == 0)
+				{
+					// every shard takes its part of the snapshot
+					for (size_t j=0; j<n; j++)
+					{
+						queues[j]->commit(fill[j], accesses);
+						out[j] = queues[j]->reserve();
+						fill[j] = 0;
+					}
+				}
+			}
+		}
+		for (size_t k=0; k<n; k++)
+		{
+			if (fill[k] > 0)
+				queues[k]->commit(fill[k]);
+			queues[k]->close();
+		}
+		for (thread &t : pool)
+			t.join();
+
+		// snapshot of the last partial interval, each ring is free after
+		// the join of its shard
+		if (log != nullptr && accesses%log->get_interval() != 0)
+		{
+			for (size_t k=0; k<n; k++)
+				log->record(k, 0, *shards[k], accesses);
+		}
+
+		// reduce the counters in the first shard
+		for (size_t k=1; k<n; k++)
+			shards[0]->add_counters(*shards[k]);
+	}
+
+	/*
+	 * Returns the cache with the counters of all the shards, after run.
+	 * 
+	 * @returns CacheModel&	Cache with the results.
+	 */
+	CacheModel& get_cache()
+	{
+		return *shards[0];
+	}
+
+	/*
+	 * Returns the number of shards.
+	 * 
+	 * @returns size_t	Number of shards.
+	 */
+	size_t size()
+	{
+		return shards.size();
+	}
+};
+
+// inclusion policies of a cache hierarchy
+enum InclusionKind
+{
+	INCLUSION_NINE,
+	INCLUSION_INCLUSIVE,
+	INCLUSION_EXCLUSIVE
+};
+
+// names of the inclusion policies, by InclusionKind
+static const char *const inclusion_names[] = {"nine", "inclusive", "exclusive"};
+
+// requests sent to a level of a cache hierarchy
+enum HierRequestKind
+{
+	HIER_LOAD,	// load of the program, only to the first level
+	HIER_STORE,	// store of the program, only to the first level
+	HIER_FETCH,	// line read by the level above after a miss
+	HIER_WRITEBACK,	// modified line evicted by the level above
+	HIER_VICTIM	// clean line evicted by the level above, if exclusive
+};
+
+// request to a level of a cache hierarchy
+struct HierRequest
+{
+	int kind;	// type of request, a HierRequestKind
+	uint64_t phy_addr;	// physical address of the request
+};
+
+// counters of a level of a cache hierarchy
+struct LevelStats
+{
+	uint64_t accesses;	// loads, stores and fetches that reached the level
+	uint64_t misses;	// accesses that missed
+	uint64_t writebacks;	// modified lines written back to this level
+	uint64_t dirty_evicts;	// modified lines sent to the level below
+	uint64_t back_invalidations;	// lines removed from the levels above
+};
+
+/*
+ * Chains several caches, the first one gets the accesses of the trace
+ * and the misses and evictions of each level are requests to the next
+ * one, the misses of the last level are memory traffic.
+ * 
+ * With NINE inclusion each level only sees the requests of the level
+ * above, so every level runs a whole batch and its misses go down as
+ * the next batch. Inclusive and exclusive hierarchies change the upper
+ * levels when a lower one evicts or hits, so their accesses go down
+ * the levels one by one.
+ */
+class CacheHierarchy
+{
+private:
+	vector<unique_ptr<CacheModel>> levels;	// caches, first level first
+	vector<LevelStats> stats;	// counters of each level
+	vector<vector<HierRequest>> requests;	// requests to each level
+	int inclusion;	// inclusion policy, an InclusionKind
+	uint64_t memory_reads;	// lines read from memory
+	uint64_t memory_writes;	// lines written to memory
+	uint64_t warmup;	// accesses run before counting
+
+	/*
+	 * Sends the line evicted by a level to the level below, inclusive
+	 * hierarchies also remove the line from the levels above.
+	 * 
+	 * @param[in] k	Level that evicted the line.
+	 * @param[in] victim	Evicted line.
+	 */
+	void evict(size_t k, const Victim &victim)
+	{
+		bool dirty = victim.dirty;
+		if (inclusion == INCLUSION_INCLUSIVE)
+		{
+			// back-invalidation, the upper levels may have smaller lines
+			uint64_t end = victim.phy_addr+levels[k]->get_block_size();
+			for (size_t j=0; j<k; j++)
+			{
+				int block = levels[j]->get_block_size();
+				for (uint64_t addr=victim.phy_addr; addr<end; addr+=block)
+				{
+					bool upper_dirty;
+					if (levels[j]->invalidate(addr, upper_dirty))
+					{
+						stats[k].back_invalidations++;
+						dirty |= upper_dirty;
+					}
+				}
+			}
+		}
+		if (dirty)
+		{
+			stats[k].dirty_evicts++;
+			requests[k+1].push_back({HIER_WRITEBACK, victim.phy_addr});
+		}
+		else if (inclusion == INCLUSION_EXCLUSIVE)
+		{
+			requests[k+1].push_back({HIER_VICTIM, victim.phy_addr});
+		}
+	}
+
+	/*
+	 * Processes the pending requests of a level and of the levels
+	 * below it.
+	 * 
+	 * @param[in] k	Level.
+	 */
+	void process(size_t k)
+	{
+		if (k == levels.size())
+		{
+			// memory
+			for (const HierRequest &req : requests[k])
+			{
+				if (req.kind == HIER_FETCH)
+					memory_reads++;
+				else if (req.kind == HIER_WRITEBACK)
+					memory_writes++;
+			}
+			requests[k].clear();
+			return;
+		}
+
+		CacheModel &cache = *levels[k];
+		LevelStats &st = stats[k];
+		for (const HierRequest &req : requests[k])
+		{
+			Victim victim;
+			victim.valid = false;
+			if (req.kind == HIER_WRITEBACK || req.kind == HIER_VICTIM)
+			{
+				// an inclusive level should have the line, if it was
+				// evicted meanwhile the line goes further down
+				bool dirty = req.kind == HIER_WRITEBACK;
+				st.writebacks += dirty;
+				bool allocate = inclusion != INCLUSION_INCLUSIVE;
+				if (!cache.fill(req.phy_addr, dirty, allocate, victim) && !allocate)
+					requests[k+1].push_back(req);
+			}
+			else if (inclusion == INCLUSION_EXCLUSIVE && k > 0)
+			{
+				// the line moves to the first level, which allocated it
+				// on the miss, the levels between missed too
+				st.accesses++;
+				bool dirty;
+				if (cache.invalidate(req.phy_addr, dirty))
+				{
+					if (dirty)
+						levels[0]->fill(req.phy_addr, true, false, victim);
+				}
+				else
+				{
+					st.misses++;
+					requests[k+1].push_back({HIER_FETCH, req.phy_addr});
+				}
+			}
+			else
+			{
+				st.accesses++;
+				if (!cache.access(req.kind == HIER_STORE, req.phy_addr, victim))
+				{
+					st.misses++;
+					requests[k+1].push_back({HIER_FETCH, req.phy_addr});
+				}
+			}
+			if (victim.valid)
+				evict(k, victim);
+		}
+		requests[k].clear();
+		process(k+1);
+	}
+
+public:
+
+	/*
+	 * Inits the caches of the hierarchy.
+	 * 
+	 * @param[in] cfgs	Configuration of each level, first level first.
+	 * @param[in] incl	Inclusion policy, an InclusionKind.
+	 */
+	CacheHierarchy(const vector<CacheConfig> &cfgs, int incl)
+	{
+		for (const CacheConfig &cfg : cfgs)
+		{
+			levels.emplace_back(make_cache(cfg.size, cfg.ways, cfg.block, cfg.policy));
+		}
+		stats.assign(levels.size(), LevelStats());
+		requests.resize(levels.size()+1);
+		inclusion = incl;
+		memory_reads = 0;
+		memory_writes = 0;
+		warmup = 0;
+	}
+
+	/*
+	 * Sets the accesses run before the counters start.
+	 * 
+	 * @param[in] n	Accesses of the warmup.
+	 */
+	void set_warmup(uint64_t n)
+	{
+		warmup = n;
+	}
+
+	/*
+	 * Runs all the accesses of a trace.
+	 * 
+	 * @param[in] trace	Accesses of the trace.
+	 */
+	void run(AccessSource *trace)
+	{
+		// requests that go down together
+		size_t step = (inclusion == INCLUSION_NINE) ? ACCESS_BATCH_SIZE : 1;
+		const Access *batch;
+		size_t batch_size;
+		uint64_t seen = 0;
+		while (trace->next(batch, batch_size))
+		{
+			size_t end;
+			for (size_t i=0; i<batch_size; i=end)
+			{
+				end = min(batch_size, i+step);
+				if (seen < warmup)
+					end = min<uint64_t>(end, i+warmup-seen);
+				for (size_t j=i; j<end; j++)
+				{
+					int kind = batch[j].ls ? HIER_STORE : HIER_LOAD;
+					requests[0].push_back({kind, batch[j].phy_addr});
+				}
+				process(0);
+				if (seen < warmup && seen+(end-i) == warmup)
+				{
+					// the counters start at the end of the warmup
+					stats.assign(levels.size(), LevelStats());
+					memory_reads = 0;
+					memory_writes = 0;
+				}
+				seen += end-i;
+			}
+		}
+	}
+
+	/*
+	 * Returns the number of levels.
+	 * 
+	 * @returns size_t	Number of levels.
+	 */
+	size_t size()
+	{
+		return levels.size();
+	}
+
+	/*
+	 * Returns the counters of a level.
+	 * 
+	 * @param[in] k	Level, 0 is the first one.
+	 * @returns LevelStats&	Counters of the level.
+	 */
+	const LevelStats& get_stats(size_t k)
+	{
+		return stats[k];
+	}
+
+	/*
+	 * Returns the inclusion policy.
+	 * 
+	 * @returns int	InclusionKind of the hierarchy.
+	 */
+	int get_inclusion()
+	{
+		return inclusion;
+	}
+
+	/*
+	 * Returns the lines read from memory.
+	 * 
+	 * @returns uint64_t	Memory reads.
+	 */
+	uint64_t get_memory_reads()
+	{
+		return memory_reads;
+	}
+
+	/*
+	 * Returns the lines written to memory.
+	 * 
+	 * @returns uint64_t	Memory writes.
+	 */
+	uint64_t get_memory_writes()
+	{
+		return memory_writes;
+	}
+};
+
+// orders of the accesses of the cores of a shared cache
+enum InterleaveKind
+{
+	INTERLEAVE_RR,
+	INTERLEAVE_TIME
+};
+
+// names of the interleavings, by InterleaveKind
+static const char *const interleave_names[] = {"rr", "time"};
+
+// partitions of the ways of a shared cache between the cores
+enum PartitionKind
+{
+	PARTITION_NONE,
+	PARTITION_WAYS,
+	PARTITION_UCP
+};
+
+/*
+ * Runs the accesses of the traces of several cores in a single order,
+ * until all the traces end.
+ * 
+ * @param[in] traces	Accesses of each core.
+ * @param[in] order	InterleaveKind of the accesses, round-robin takes
+ * 					an access of each core in turn, by time the next
+ * 					access is the one of the core with fewer
+ * 					instructions run.
+ * @param[in] visit	Function called with the core and each access.
+ */
+template <typename F>
+void interleave_traces(const vector<AccessSource*> &traces, int order, F visit)
+{
+	int cores = traces.size();
+	vector<const Access*> batch(cores);
+	vector<size_t> left(cores, 0);
+	vector<bool> live(cores, true);
+	vector<uint64_t> clock(cores, 0);
+	int last = cores-1;
+	while (true)
+	{
+		// core of the next access
+		int core = -1;
+		for (int j=0; j<cores; j++)
+		{
+			int c = order == INTERLEAVE_RR ? (last+1+j)%cores : j;
+			while (live[c] && left[c] == 0)
+				live[c] = traces[c]->next(batch[c], left[c]);
+			if (!live[c])
+				continue;
+			if (order == INTERLEAVE_RR)
+			{
+				core = c;
+				break;
+			}
+			if (core < 0 || clock[c] < clock[core])
+				core = c;
+		}
+		if (core < 0)
+			break;
+
+		const Access &a = *batch[core]++;
+		left[core]--;
+		clock[core] += a.insts+1;
+		last = core;
+		visit(core, a);
+	}
+}
+
+/*
+ * Utility monitor of a core for UCP (Qureshi and Patt, 2006): an LRU
+ * directory of the tags of a sample of the sets with all the ways of
+ * the shared cache, only for the accesses of the core. It counts the
+ * hits of each position of the LRU stack, so the hits the core would
+ * get with k ways are the sum of the first k counters.
+ */
+class UtilityMonitor
+{
+private:
+	int ways;	// ways of the shared cache
+	uint64_t stride;	// one set every stride is sampled
+	vector<uint64_t> lines;	// lines of each sampled set, most recent first
+	vector<uint64_t> hits;	// hits of each position of the stack
+
+public:
+
+	/*
+	 * Inits an empty monitor.
+	 * 
+	 * @param[in] w	Ways of the shared cache.
+	 * @param[in] num_sets	Sets of the shared cache.
+	 */
+	UtilityMonitor(int w, uint64_t num_sets)
+	{
+		ways = w;
+		stride = max<uint64_t>(num_sets/UMON_SETS, 1);
+		lines.assign(min<uint64_t>(num_sets, UMON_SETS)*ways, INVALID_TAG);
+		hits.assign(ways, 0);
+	}
+
+	/*
+	 * Records an access of the core.
+	 * 
+	 * @param[in] index	Set of the access in the shared cache.
+	 * @param[in] line	Line of the access.
+	 */
+	void access(uint64_t index, uint64_t line)
+	{
+		if (index%stride != 0 || index/stride >= lines.size()/ways)
+			return;
+		uint64_t *set = &lines[index/stride*ways];
+		int k = 0;
+		while (k < ways-1 && set[k] != line)
+			k++;
+		if (set[k] == line)
+			hits[k]++;
+		// moves the line to the top of the stack
+		memmove(set+1, set, k*sizeof(uint64_t));
+		set[0] = line;
+	}
+
+	/*
+	 * Returns the hits the core would get with some ways.
+	 * 
+	 * @param[in] k	Number of ways.
+	 * @returns uint64_t	Hits in the sampled sets.
+	 */
+	uint64_t utility(int k) const
+	{
+		uint64_t u = 0;
+		for (int j=0; j<k; j++)
+			u += hits[j];
+		return u;
+	}
+
+	/*
+	 * Halves the counters, so the old accesses weigh less.
+	 */
+	void decay()
+	{
+		for (uint64_t &h : hits)
+			h /= 2;
+	}
+};
+
+/*
+ * Cache shared by several cores, each with its own trace. The accesses
+ * of the traces are interleaved round-robin, one access of each core
+ * in turn, or by time, where the next access is the one of the core
+ * with fewer instructions run so far. The addresses of each core are
+ * tagged with the core in their top bits, so the cores don't share
+ * lines, and the counters of each core are kept apart.
+ * 
+ * The ways may be partitioned between the cores, a core hits its lines
+ * in any way but its misses allocate only in its own ways. The
+ * partition is fixed, or set by UCP from the utility monitors of the
+ * cores with the lookahead algorithm, every period accesses.
+ */
+class SharedCache
+{
+private:
+	unique_ptr<CacheModel> cache;	// shared cache
+	int ways;	// ways of the shared cache
+	int interleave;	// order of the accesses, an InterleaveKind
+	int partition;	// partition of the ways, a PartitionKind
+	vector<int> alloc;	// ways of each core when partitioned
+	vector<uint64_t> masks;	// ways where the misses of each core allocate
+	vector<UtilityMonitor> monitors;	// utility of each core for UCP
+	uint64_t period;	// accesses between the repartitions of UCP
+	uint64_t repartitions;	// times UCP changed the partition
+	uint64_t warmup;	// accesses run before counting
+	vector<CacheCounters> counters;	// counters of each core
+	vector<uint64_t> interference;	// lines of each core evicted by other cores
+
+	/*
+	 * Gives each core its ways, core 0 gets the first ones.
+	 * 
+	 * @param[in] a	Ways of each core.
+	 */
+	void set_alloc(const vector<int> &a)
+	{
+		alloc = a;
+		int first = 0;
+		for (size_t c=0; c<a.size(); c++)
+		{
+			uint64_t m = a[c] == 64 ? ~0ULL : (1ULL<<a[c])-1;
+			masks[c] = m<<first;
+			first += a[c];
+		}
+	}
+
+	/*
+	 * Splits the ways between the cores with the lookahead algorithm of
+	 * UCP: every core gets a way and the rest go, a few at a time, to
+	 * the core with the most hits gained per way.
+	 */
+	void repartition()
+	{
+		int cores = monitors.size();
+		vector<int> a(cores, 1);
+		int balance = ways-cores;
+		while (balance > 0)
+		{
+			int winner = 0;
+			int winner_ways = 1;
+			double best = -1;
+			for (int c=0; c<cores; c++)
+			{
+				uint64_t base = monitors[c].utility(a[c]);
+				for (int k=1; k<=balance; k++)
+				{
+					double mu = (double)(monitors[c].utility(a[c]+k)-base)/k;
+					if (mu > best)
+					{
+						best = mu;
+						winner = c;
+						winner_ways = k;
+					}
+				}
+			}
+			a[winner] += winner_ways;
+			balance -= winner_ways;
+		}
+		if (a != alloc)
+			repartitions++;
+		set_alloc(a);
+		for (UtilityMonitor &m : monitors)
+			m.decay();
+	}
+
+	/*
+	 * Runs an access of a core.
+	 * 
+	 * @param[in] core	Core of the access.
+	 * @param[in] a	Access.
+	 */
+	void access(int core, const Access &a)
+	{
+		uint64_t addr = a.phy_addr^((uint64_t)core<<CORE_ADDR_SHIFT);
+		if (partition == PARTITION_UCP)
+			monitors[core].access(cache->get_index(addr), addr/cache->get_block_size());
+		cache->set_way_mask(masks[core]);
+		Victim victim;
+		bool hit = cache->access(a.ls, addr, victim);
+
+		CacheCounters &cnt = counters[core];
+		cnt.access++;
+		if (hit)
+			(a.ls ? cnt.store_hit : cnt.read_hit)++;
+		else
+			(a.ls ? cnt.store_misses : cnt.read_misses)++;
+		if (victim.valid)
+		{
+			// the evicted line belongs to the core in its top bits
+			uint64_t owner = victim.phy_addr>>CORE_ADDR_SHIFT;
+			if (owner >= counters.size())
+				owner = core;
+			counters[owner].dirty_evicts += victim.dirty;
+			interference[owner] += owner != (uint64_t)core;
+		}
+	}
+
+public:
+
+	/*
+	 * Inits the shared cache, without partitions.
+	 * 
+	 * @param[in] cfg	Configuration of the shared cache.
+	 * @param[in] cores	Number of cores.
+	 * @param[in] order	Interleaving of the accesses, an InterleaveKind.
+	 */
+	SharedCache(const CacheConfig &cfg, int cores, int order)
+		: cache(make_cache(cfg))
+	{
+		ways = cfg.ways;
+		interleave = order;
+		partition = PARTITION_NONE;
+		alloc.assign(cores, 0);
+		masks.assign(cores, ~0ULL);
+		period = 0;
+		repartitions = 0;
+		warmup = 0;
+		counters.assign(cores, CacheCounters());
+		interference.assign(cores, 0);
+	}
+
+	/*
+	 * Partitions the ways, each core gets a fixed number of them.
+	 * 
+	 * @param[in] a	Ways of each core, at least 1 and up to 64 in total.
+	 */
+	void set_partition(const vector<int> &a)
+	{
+		partition = PARTITION_WAYS;
+		set_alloc(a);
+	}
+
+	/*
+	 * Partitions the ways with UCP, the ways start split evenly.
+	 * 
+	 * @param[in] p	Accesses between repartitions.
+	 */
+	void set_ucp(uint64_t p)
+	{
+		int cores = counters.size();
+		partition = PARTITION_UCP;
+		period = p;
+		vector<int> a(cores, ways/cores);
+		for (int c=0; c<ways%cores; c++)
+			a[c]++;
+		set_alloc(a);
+		monitors.assign(cores, UtilityMonitor(ways, cache->get_num_sets()));
+	}
+
+	/*
+	 * Sets the accesses run before the counters start, counted over
+	 * all the cores.
+	 * 
+	 * @param[in] n	Accesses of the warmup.
+	 */
+	void set_warmup(uint64_t n)
+	{
+		warmup = n;
+	}
+
+	/*
+	 * Runs the traces of the cores until all of them end.
+	 * 
+	 * @param[in] traces	Accesses of each core.
+	 */
+	void run(const vector<AccessSource*> &traces)
+	{
+		int cores = traces.size();
+		uint64_t seen = 0;
+		interleave_traces(traces, interleave, [&](int core, const Access &a) {
+			access(core, a);
+			seen++;
+			if (seen == warmup)
+			{
+				// the counters start at the end of the warmup
+				cache->reset_counters();
+				counters.assign(cores, CacheCounters());
+				interference.assign(cores, 0);
+			}
+			if (partition == PARTITION_UCP && seen%period == 0)
+				repartition();
+		});
+	}
+
+	/*
+	 * Returns the number of cores.
+	 * 
+	 * @returns size_t	Number of cores.
+	 */
+	size_t size()
+	{
+		return counters.size();
+	}
+
+	/*
+	 * Returns the shared cache, its counters cover all the cores.
+	 * 
+	 * @returns CacheModel&	Shared cache.
+	 */
+	CacheModel& get_cache()
+	{
+		return *cache;
+	}
+
+	/*
+	 * Returns the counters of a core, its dirty evictions are the ones
+	 * of its lines, by any core.
+	 * 
+	 * @param[in] c	Core.
+	 * @returns CacheCounters&	Counters of the core.
+	 */
+	const CacheCounters& get_counters(size_t c)
+	{
+		return counters[c];
+	}
+
+	/*
+	 * Returns the lines of a core evicted by misses of other cores.
+	 * 
+	 * @param[in] c	Core.
+	 * @returns uint64_t	Lines evicted.
+	 */
+	uint64_t get_interference(size_t c)
+	{
+		return interference[c];
+	}
+
+	/*
+	 * Returns the ways of a core, 0 if the cache isn't partitioned.
+	 * 
+	 * @param[in] c	Core.
+	 * @returns int	Ways of the core at the end of the run.
+	 */
+	int get_ways(size_t c)
+	{
+		return alloc[c];
+	}
+
+	/*
+	 * Returns the order of the accesses of the cores.
+	 * 
+	 * @returns int	InterleaveKind of the cache.
+	 */
+	int get_interleave()
+	{
+		return interleave;
+	}
+
+	/*
+	 * Returns the partition of the ways.
+	 * 
+	 * @returns int	PartitionKind of the cache.
+	 */
+	int get_partition()
+	{
+		return partition;
+	}
+
+	/*
+	 * Returns the times UCP changed the partition.
+	 * 
+	 * @returns uint64_t	Repartitions.
+	 */
+	uint64_t get_repartitions()
+	{
+		return repartitions;
+	}
+};
+
+// coherence protocols of the private caches of the cores
+enum CoherenceKind
+{
+	COHERENCE_MESI,
+	COHERENCE_MOESI
+};
+
+// names of the coherence protocols, by CoherenceKind
+static const char *const coherence_names[] = {"mesi", "moesi"};
+
+// coherence counters of a core
+struct CoherenceCounters
+{
+	uint64_t invalidations;	// lines invalidated in other caches
+	uint64_t upgrades;	// writes to lines shared with other caches
+	uint64_t transfers;	// lines received from another private cache
+	uint64_t downgrades;	// modified lines of other caches written back to share them
+	uint64_t coherence_misses;	// misses on lines invalidated by other cores
+	uint64_t control_msgs;	// coherence messages without data
+	uint64_t data_msgs;	// coherence messages with a line
+};
+
+// state of a line in the directory of the private caches
+struct DirectoryEntry
+{
+	uint64_t sharers;	// cores with the line
+	uint64_t invalidated;	// cores that lost the line by an invalidation
+	int owner;	// core with the line in E, M or O state, -1 if none
+};
+
+/*
+ * Private caches of several cores kept coherent by a directory, over a
+ * shared level. Each core runs its own trace and the cores share the
+ * addresses, the accesses are interleaved like in SharedCache.
+ * 
+ * The state of a line in a private cache comes from the directory and
+ * the dirty bit of the line: I when the core isn't a sharer, E when it
+ * is the owner of a clean line, M or O when the line is dirty, M if no
+ * other core shares it, and S otherwise. A read miss gets the line from
+ * the owner if there is one and from the shared level if not, and is E
+ * when no other core has the line. A write invalidates the line in the
+ * other caches, as an upgrade if the core already had the line. With
+ * MESI a modified line read by another core is written back to the
+ * shared level and becomes S, with MOESI it becomes O and the owner
+ * keeps supplying it.
+ * 
+ * Only the coherence messages are counted as traffic: the request to
+ * the owner and the line it sends, the invalidations and their
+ * acknowledgments, the upgrades and the writebacks of the downgrades.
+ */
+class CoherentCaches
+{
+private:
+	vector<unique_ptr<CacheModel>> privates;	// private cache of each core
+	unique_ptr<CacheModel> shared;	// level below the private caches
+	int protocol;	// CoherenceKind of the private caches
+	int interleave;	// order of the accesses, an InterleaveKind
+	int block;	// block size of the private caches
+	unordered_map<uint64_t,DirectoryEntry> directory;	// state of the lines, by line
+	vector<CoherenceCounters> counters;	// coherence counters of each core
+	uint64_t writebacks;	// dirty lines written to the shared level
+	uint64_t warmup;	// accesses run before counting
+
+	/*
+	 * Reads a line from the shared level.
+	 * 
+	 * @param[in] addr	Address of the line.
+	 */
+	void read_shared(uint64_t addr)
+	{
+		Victim victim;
+		shared->access(0, addr, victim);
+	}
+
+	/*
+	 * Writes a modified line to the shared level.
+	 * 
+	 * @param[in] addr	Address of the line.
+	 */
+	void write_shared(uint64_t addr)
+	{
+		Victim victim;
+		shared->fill(addr, true, true, victim);
+		writebacks++;
+	}
+
+	/*
+	 * Removes a line evicted by a private cache from the directory.
+	 * 
+	 * @param[in] core	Core of the cache.
+	 * @param[in] victim	Evicted line.
+	 */
+	void evict(int core, const Victim &victim)
+	{
+		auto it = directory.find(victim.phy_addr/block);
+		if (it != directory.end())
+		{
+			DirectoryEntry &d = it->second;
+			d.sharers &= ~(1ULL<<core);
+			if (d.owner == core)
+				d.owner = -1;
+			if (d.sharers == 0 && d.invalidated == 0)
+				directory.erase(it);
+		}
+		if (victim.dirty)
+			write_shared(victim.phy_addr);
+	}
+
+	/*
+	 * Runs an access of a core.
+	 * 
+	 * @param[in] core	Core of the access.
+	 * @param[in] a	Access.
+	 */
+	void access(int core, const Access &a)
+	{
+		uint64_t line = a.phy_addr/block;
+		uint64_t addr = line*block;
+		uint64_t bit = 1ULL<<core;
+		CoherenceCounters &cnt = counters[core];
+		auto it = directory.find(line);
+		if (it == directory.end())
+			it = directory.emplace(line, DirectoryEntry{0, 0, -1}).first;
+		DirectoryEntry &d = it->second;
+
+		bool present = (d.sharers & bit) != 0;
+		if (!present)
+		{
+			if (d.invalidated & bit)
+				cnt.coherence_misses++;
+			d.invalidated &= ~bit;
+			if (d.owner >= 0)
+			{
+				// the owner sends the line
+				cnt.transfers++;
+				cnt.control_msgs++;
+				cnt.data_msgs++;
+			}
+			else
+			{
+				read_shared(addr);
+			}
+		}
+
+		if (a.ls != 0)
+		{
+			uint64_t others = d.sharers & ~bit;
+			if (present && others != 0)
+			{
+				cnt.upgrades++;
+				cnt.control_msgs++;
+			}
+			// the other copies are invalidated, a modified one is
+			// overwritten by this write
+			for (int c=0; others != 0; c++, others >>= 1)
+			{
+				if ((others & 1) == 0)
+					continue;
+				bool dirty;
+				privates[c]->invalidate(addr, dirty);
+				cnt.invalidations++;
+				cnt.control_msgs += 2;
+				d.invalidated |= 1ULL<<c;
+			}
+			d.sharers = bit;
+			d.owner = core;
+		}
+		else if (!present)
+		{
+			if (d.owner >= 0)
+			{
+				bool dirty = false;
+				if (protocol == COHERENCE_MESI)
+				{
+					// M goes to S through the shared level
+					if (privates[d.owner]->clean(addr))
+					{
+						cnt.downgrades++;
+						cnt.data_msgs++;
+						write_shared(addr);
+					}
+				}
+				else
+				{
+					// M goes to O and keeps the owner
+					privates[d.owner]->probe(addr, dirty);
+				}
+				if (!dirty)
+					d.owner = -1;
+			}
+			else if (d.sharers == 0)
+			{
+				// E, no other core has the line
+				d.owner = core;
+			}
+			d.sharers |= bit;
+		}
+
+		Victim victim;
+		privates[core]->access(a.ls, addr, victim);
+		if (victim.valid)
+			evict(core, victim);
+	}
+
+public:
+
+	/*
+	 * Inits the caches of the cores, all of them empty.
+	 * 
+	 * @param[in] priv	Configuration of the private caches.
+	 * @param[in] cfg	Configuration of the shared level, its blocks
+	 * 					can't be smaller than the private ones.
+	 * @param[in] cores	Number of cores, up to 64.
+	 * @param[in] coherence	CoherenceKind of the private caches.
+	 * @param[in] order	Interleaving of the accesses, an InterleaveKind.
+	 */
+	CoherentCaches(const CacheConfig &priv, const CacheConfig &cfg, int cores,
+		int coherence, int order)
+		: shared(make_cache(cfg))
+	{
+		for (int c=0; c<cores; c++)
+			privates.emplace_back(make_cache(priv));
+		protocol = coherence;
+		interleave = order;
+		block = priv.block;
+		counters.assign(cores, CoherenceCounters());
+		writebacks = 0;
+		warmup = 0;
+	}
+
+	/*
+	 * Sets the accesses run before the counters start, counted over
+	 * all the cores.
+	 * 
+	 * @param[in] n	Accesses of the warmup.
+	 */
+	void set_warmup(uint64_t n)
+	{
+		warmup = n;
+	}
+
+	/*
+	 * Runs the traces of the cores until all of them end.
+	 * 
+	 * @param[in] traces	Accesses of each core.
+	 */
+	void run(const vector<AccessSource*> &traces)
+	{
+		uint64_t seen = 0;
+		interleave_traces(traces, interleave, [&](int core, const Access &a) {
+			access(core, a);
+			seen++;
+			if (seen == warmup)
+			{
+				// the counters start at the end of the warmup
+				for (unique_ptr<CacheModel> &p : privates)
+					p->reset_counters();
+				shared->reset_counters();
+				counters.assign(counters.size(), CoherenceCounters());
+				writebacks = 0;
+			}
+		});
+	}
+
+	/*
+	 * Returns the number of cores.
+	 * 
+	 * @returns size_t	Number of cores.
+	 */
+	size_t size()
+	{
+		return privates.size();
+	}
+
+	/*
+	 * Returns the private cache of a core.
+	 * 
+	 * @param[in] c	Core.
+	 * @returns CacheModel&	Private cache.
+	 */
+	CacheModel& get_private(size_t c)
+	{
+		return *privates[c];
+	}
+
+	/*
+	 * Returns the shared level, its accesses are the misses of the
+	 * private caches that no other cache supplied.
+	 * 
+	 * @returns CacheModel&	Shared level.
+	 */
+	CacheModel& get_shared()
+	{
+		return *shared;
+	}
+
+	/*
+	 * Returns the coherence counters of a core, counted by the core that
+	 * sent the request.
+	 * 
+	 * @param[in] c	Core.
+	 * @returns CoherenceCounters&	Counters of the core.
+	 */
+	const CoherenceCounters& get_counters(size_t c)
+	{
+		return counters[c];
+	}
+
+	/*
+	 * Returns the dirty lines written to the shared level, by evictions
+	 * and downgrades.
+	 * 
+	 * @returns uint64_t	Writebacks.
+	 */
+	uint64_t get_writebacks()
+	{
+		return writebacks;
+	}
+
+	/*
+	 * Returns the bytes of the coherence messages, messages without data
+	 * take COHERENCE_CTRL_BYTES and the others a line more.
+	 * 
+	 * @returns uint64_t	Coherence traffic in bytes.
+	 */
+	uint64_t get_traffic()
+	{
+		uint64_t bytes = 0;
+		for (const CoherenceCounters &cnt : counters)
+			bytes += (cnt.control_msgs+cnt.data_msgs)*COHERENCE_CTRL_BYTES+
+				cnt.data_msgs*block;
+		return bytes;
+	}
+
+	/*
+	 * Returns the coherence protocol.
+	 * 
+	 * @returns int	CoherenceKind of the private caches.
+	 */
+	int get_protocol()
+	{
+		return protocol;
+	}
+};
+
+/*
+ * Fenwick tree over counters, gives prefix sums and updates in
+ * O(log n).
+ */
+class FenwickTree
+{
+private:
+	vector<int64_t> tree;	// partial sums, tree[i] covers (i-lowbit(i), i]
+
+public:
+
+	/*
+	 * Inits a tree with all the counters in 0.
+	 * 
+	 * @param[in] n	Number of counters.
+	 */
+	FenwickTree(size_t n = 0) : tree(n+1, 0)
+	{
+	}
+
+	/*
+	 * Returns the number of counters.
+	 * 
+	 * @returns size_t	Number of counters.
+	 */
+	size_t size()
+	{
+		return tree.size()-1;
+	}
+
+	/*
+	 * Adds a value to a counter.
+	 * 
+	 * @param[in] i	Counter, from 0.
+	 * @param[in] v	Value to add.
+	 */
+	void add(size_t i, int64_t v)
+	{
+		for (i++; i<tree.size(); i+=i&-i)
+			tree[i] += v;
+	}
+
+	/*
+	 * Returns the sum of the counters before i.
+	 * 
+	 * @param[in] i	End of the range, not included.
+	 * @returns int64_t	Sum of the counters 0..i-1.
+	 */
+	int64_t prefix(size_t i)
+	{
+		int64_t sum = 0;
+		for (; i>0; i-=i&-i)
+			sum += tree[i];
+		return sum;
+	}
+};
+
+/*
+ * Hash table from lines to the time of their last access, with open
+ * addressing and linear probing over a flat array, so the lookups of
+ * the profiler don't allocate.
+ */
+class LineTimes
+{
+private:
+	vector<uint64_t> lines;	// line of each slot, INVALID_TAG if empty
+	vector<uint64_t> times;	// time of each slot
+	size_t count;	// lines in the table
+
+	/*
+	 * Returns the slot of a line, or the empty slot where it goes.
+	 * 
+	 * @param[in] line	Line to search.
+	 * @returns size_t	Slot of the line.
+	 */
+	size_t slot(uint64_t line)
+	{
+		size_t mask = lines.size()-1;
+		size_t k = (line*0x9E3779B97F4A7C15ULL)>>(64-__builtin_ctzll(lines.size()));
+		while (lines[k] != line && lines[k] != INVALID_TAG)
+			k = (k+1)&mask;
+		return k;
+	}
+
+	/*
+	 * Doubles the slots of the table.
+	 */
+	void grow()
+	{
+		vector<uint64_t> old_lines(2*lines.size(), INVALID_TAG);
+		vector<uint64_t> old_times(2*lines.size());
+		old_lines.swap(lines);
+		old_times.swap(times);
+		for (size_t k=0; k<old_lines.size(); k++)
+		{
+			if (old_lines[k] == INVALID_TAG)
+				continue;
+			size_t j = slot(old_lines[k]);
+			lines[j] = old_lines[k];
+			times[j] = old_times[k];
+		}
+	}
+
+public:
+	LineTimes() : lines(1024, INVALID_TAG), times(1024)
+	{
+		count = 0;
+	}
+
+	/*
+	 * Sets the time of a line and returns the previous one.
+	 * 
+	 * @param[in] line	Line accessed.
+	 * @param[in] t	Time of the access.
+	 * @param[out] prev	Time of the previous access of the line.
+	 * @returns bool	False if the line had no previous access.
+	 */
+	bool update(uint64_t line, uint64_t t, uint64_t &prev)
+	{
+		size_t k = slot(line);
+		if (lines[k] == line)
+		{
+			prev = times[k];
+			times[k] = t;
+			return true;
+		}
+		lines[k] = line;
+		times[k] = t;
+		if (2*++count > lines.size())
+			grow();
+		return false;
+	}
+
+	/*
+	 * Returns the number of lines.
+	 * 
+	 * @returns size_t	Lines in the table.
+	 */
+	size_t size()
+	{
+		return count;
+	}
+
+	/*
+	 * Calls f(time) for the time of every line, f returns the new time.
+	 */
+	template<class F>
+	void remap(F f)
+	{
+		for (size_t k=0; k<lines.size(); k++)
+		{
+			if (lines[k] != INVALID_TAG)
+				times[k] = f(times[k]);
+		}
+	}
+};
+
+/*
+ * LRU stack distance profile of a trace for one block size. The
+ * distance of a fully associative access is the number of distinct
+ * lines used since the previous access to its line, counted with a
+ * Fenwick tree that marks the time of the last access of every line.
+ * For set associative caches each number of sets keeps the LRU stack
+ * of every set, as deep as the largest associativity, so the position
+ * of a line in the stack of its set is its distance.
+ */
+class StackProfile
+{
+private:
+	int block;	// block size in bytes
+	int offset;	// bits of the offset in the line
+	uint64_t accesses;	// accesses profiled
+	LineTimes last;	// time of the last access of each line
+	FenwickTree marks;	// 1 at the time of the last access of each line
+	uint64_t now;	// time of the next access
+	vector<uint64_t> hist;	// fully associative distances up to max_lines
+	vector<int> set_bits;	// index bits of each set associative profile
+	vector<vector<uint64_t>> stacks;	// stacks of the sets of each profile
+	vector<vector<uint64_t>> set_hist;	// distances in the sets of each profile
+	int depth;	// depth of the stacks of the sets
+
+	/*
+	 * Renumbers the times of the last accesses from 0 when the tree is
+	 * full, and makes room for as many accesses as there are lines.
+	 */
+	void compact()
+	{
+		// the new time of a line is the number of lines used before it
+		vector<uint64_t> rank(now+1, 0);
+		last.remap([&rank](uint64_t t) { rank[t+1] = 1; return t; });
+		for (size_t t=1; t<=now; t++)
+			rank[t] += rank[t-1];
+		last.remap([&rank](uint64_t t) { return rank[t]; });
+		now = last.size();
+		marks = FenwickTree(max<size_t>(2*now, ACCESS_BATCH_SIZE));
+		for (size_t t=0; t<now; t++)
+			marks.add(t, 1);
+	}
+
+public:
+
+	/*
+	 * Inits an empty profile.
+	 * 
+	 * @param[in] b	Block size in bytes.
+	 * @param[in] max_lines	Largest fully associative cache of interest, in lines.
+	 * @param[in] sets	Numbers of sets of the set associative caches,
+	 * 					powers of two.
+	 * @param[in] max_ways	Largest associativity of interest.
+	 */
+	StackProfile(int b, long max_lines, const vector<long> &sets, int max_ways)
+		: marks(ACCESS_BATCH_SIZE), hist(max_lines, 0)
+	{
+		block = b;
+		offset = (int)round(log2(b));
+		accesses = 0;
+		now = 0;
+		depth = max_ways;
+		for (long n : sets)
+		{
+			set_bits.push_back((int)round(log2(n)));
+			stacks.emplace_back(n*depth, INVALID_TAG);
+			set_hist.emplace_back(depth, 0);
+		}
+	}
+
+	/*
+	 * Profiles an access.
+	 * 
+	 * @param[in] phy_addr	Physical address of the access.
+	 */
+	void access(uint64_t phy_addr)
+	{
+		uint64_t line = phy_addr>>offset;
+		accesses++;
+
+		// fully associative distance
+		if (now == marks.size())
+			compact();
+		uint64_t prev;
+		if (last.update(line, now, prev))
+		{
+			// every line has one mark, the ones after prev were used
+			// since the previous access
+			uint64_t d = last.size()-marks.prefix(prev+1);
+			if (d < hist.size())
+				hist[d]++;
+			marks.add(prev, -1);
+		}
+		marks.add(now, 1);
+		now++;
+
+		// distance in the stack of the set, the line moves to the top
+		for (size_t k=0; k<set_bits.size(); k++)
+		{
+			uint64_t *stack = &stacks[k][(line&(((uint64_t)1<<set_bits[k])-1))*depth];
+			int d = find_tag(stack, depth, line);
+			if (d >= 0)
+				set_hist[k][d]++;
+			else
+				d = depth-1;
+			memmove(stack+1, stack, d*sizeof(uint64_t));
+			stack[0] = line;
+		}
+	}
+
+	/*
+	 * Returns the block size of the profile.
+	 * 
+	 * @returns int	Block size in bytes.
+	 */
+	int get_block_size()
+	{
+		return block;
+	}
+
+	/*
+	 * Returns the accesses profiled.
+	 * 
+	 * @returns uint64_t	Accesses.
+	 */
+	uint64_t get_accesses()
+	{
+		return accesses;
+	}
+
+	/*
+	 * Returns the distinct lines of the trace, the cold misses of any
+	 * cache.
+	 * 
+	 * @returns uint64_t	Distinct lines.
+	 */
+	uint64_t get_lines()
+	{
+		return last.size();
+	}
+
+	/*
+	 * Returns the miss rate of a fully associative LRU cache.
+	 * 
+	 * @param[in] lines	Lines of the cache, at most max_lines.
+	 * @returns double	Miss rate.
+	 */
+	double full_miss_rate(long lines)
+	{
+		uint64_t hits = 0;
+		for (long d=0; d<lines && d<(long)hist.size(); d++)
+			hits += hist[d];
+		return accesses ? (double)(accesses-hits)/accesses : 0.0;
+	}
+
+	/*
+	 * Returns the miss rate of a set associative LRU cache.
+	 * 
+	 * @param[in] sets	Number of sets, one of the profiled ones.
+	 * @param[in] ways	Associativity, up to max_ways.
+	 * @returns double	Miss rate.
+	 */
+	double set_miss_rate(long sets, int ways)
+	{
+		int bits = (int)round(log2(sets));
+		size_t k = find(set_bits.begin(), set_bits.end(), bits)-set_bits.begin();
+		uint64_t hits = 0;
+		for (int d=0; d<ways; d++)
+			hits += set_hist[k][d];
+		return accesses ? (double)(accesses-hits)/accesses : 0.0;
+	}
+};
+
+/*
+ * Returns the number of sets of a configuration, as CacheModel
+ * computes it.
+ * 
+ * @param[in] cfg	Configuration of the cache.
+ * @returns long	Number of sets.
+ */
+inline long config_sets(const CacheConfig &cfg)
+{
+	return 1L<<(int)log2((double)cfg.size*1024/((long)cfg.ways*cfg.block));
+}
+
+} // namespace cachesim
+
+#endif
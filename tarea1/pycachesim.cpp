@@ -0,0 +1,443 @@
+/*
+ * file: pycachesim.cpp
+ * 
+ * Python module of the cachesim library (make python), to run traces
+ * generated or loaded by Python programs without writing them to a
+ * file. The traces are passed as arrays of addresses, types and
+ * instructions through the buffer protocol (NumPy arrays, array.array,
+ * bytes...), so they are not copied, and the simulation runs without
+ * the GIL. The counters are returned as dicts.
+ * 
+ *	import cachesim, numpy as np
+ *	c = cachesim.Cache(32, 8, 64, "srrip")
+ *	c.run(addrs, types)	# np.uint64 and np.uint8 arrays
+ *	c.stats()["miss_rate"]
+ *	cachesim.sweep([(32, 8, 64), (64, 16, 64, "lru")], addrs, types, threads=2)
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "cachesim.h"
+
+using namespace std;
+using namespace cachesim;
+
+
+/*
+ * Python object of a cache.
+ */
+struct PyCache
+{
+	PyObject_HEAD
+	CacheModel *cache;	// simulated cache
+	CacheConfig cfg;	// configuration of the cache
+	bool busy;	// a thread is running accesses in the cache
+};
+
+/*
+ * Arrays of the accesses of a trace, borrowed from Python objects.
+ */
+struct TraceArrays
+{
+	Py_buffer addrs;	// physical addresses, uint64
+	Py_buffer types;	// types(0:load/else store), uint8, may be empty
+	Py_buffer pcs;	// instructions, uint64, may be empty
+	size_t count;	// number of accesses
+
+	TraceArrays()
+	{
+		memset(&addrs, 0, sizeof(addrs));
+		memset(&types, 0, sizeof(types));
+		memset(&pcs, 0, sizeof(pcs));
+		count = 0;
+	}
+
+	~TraceArrays()
+	{
+		if (addrs.obj)
+			PyBuffer_Release(&addrs);
+		if (types.obj)
+			PyBuffer_Release(&types);
+		if (pcs.obj)
+			PyBuffer_Release(&pcs);
+	}
+};
+
+/*
+ * Borrows the contiguous buffer of an array of integers.
+ * 
+ * @param[in] obj	Object with the array.
+ * @param[out] view	Buffer of the array.
+ * @param[in] itemsize	Bytes of each element.
+ * @param[in] name	Name of the argument, for the errors.
+ * @returns bool	False with a Python exception on errors.
+ */
+static bool get_array(PyObject *obj, Py_buffer *view, Py_ssize_t itemsize, const char *name)
+{
+	if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+		return false;
+
+	// integers of the host byte order, bool for the types
+	const char *f = view->format ? view->format : "B";
+	if (*f == '@' || *f == '=' || *f == '<')
+		f++;
+	bool integer = f[0] != '\0' && f[1] == '\0' && strchr("bBhHiIlLqQnN?", f[0]);
+	if (!integer || view->itemsize != itemsize || view->ndim > 1)
+	{
+		PyErr_Format(PyExc_TypeError, "%s must be a contiguous array of %d byte integers",
+			name, (int)itemsize);
+		PyBuffer_Release(view);
+		memset(view, 0, sizeof(*view));
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Borrows the arrays of a trace.
+ * 
+ * @param[in] addrs	Addresses of the accesses.
+ * @param[in] types	Types of the accesses, or None for loads.
+ * @param[in] pcs	Instructions of the accesses, or None.
+ * @param[out] t	Arrays of the trace.
+ * @returns bool	False with a Python exception on errors.
+ */
+static bool get_trace(PyObject *addrs, PyObject *types, PyObject *pcs, TraceArrays &t)
+{
+	if (!get_array(addrs, &t.addrs, 8, "addrs"))
+		return false;
+	t.count = t.addrs.len/8;
+	if (types != nullptr && types != Py_None)
+	{
+		if (!get_array(types, &t.types, 1, "types"))
+			return false;
+		if ((size_t)t.types.len != t.count)
+		{
+			PyErr_SetString(PyExc_ValueError, "types and addrs have different lengths");
+			return false;
+		}
+	}
+	if (pcs != nullptr && pcs != Py_None)
+	{
+		if (!get_array(pcs, &t.pcs, 8, "pcs"))
+			return false;
+		if ((size_t)t.pcs.len/8 != t.count)
+		{
+			PyErr_SetString(PyExc_ValueError, "pcs and addrs have different lengths");
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Source of the accesses of the arrays of a trace.
+ * 
+ * @param[in] t	Arrays of the trace.
+ * @returns ArraySource	Source of the accesses.
+ */
+static ArraySource trace_source(const TraceArrays &t)
+{
+	return ArraySource((const uint64_t*)t.addrs.buf, (const uint8_t*)t.types.buf,
+		(const uint64_t*)t.pcs.buf, t.count);
+}
+
+/*
+ * Adds an entry to a dict, the reference of the value is taken.
+ * 
+ * @param[in] d	Dict.
+ * @param[in] key	Key of the entry.
+ * @param[in] v	Value of the entry.
+ * @returns bool	False with a Python exception on errors.
+ */
+static bool set_item(PyObject *d, const char *key, PyObject *v)
+{
+	if (v == nullptr)
+		return false;
+	int r = PyDict_SetItemString(d, key, v);
+	Py_DECREF(v);
+	return r == 0;
+}
+
+/*
+ * Returns the configuration and counters of a cache as a dict.
+ * 
+ * @param[in] cfg	Configuration of the cache.
+ * @param[in] c	Counters of the cache.
+ * @returns PyObject*	New dict, null with a Python exception on errors.
+ */
+static PyObject* stats_dict(const CacheConfig &cfg, const CacheCounters &c)
+{
+	PyObject *d = PyDict_New();
+	uint64_t misses = c.read_misses+c.store_misses;
+	if (d == nullptr ||
+		!set_item(d, "size", PyLong_FromLong(cfg.size)) ||
+		!set_item(d, "ways", PyLong_FromLong(cfg.ways)) ||
+		!set_item(d, "block", PyLong_FromLong(cfg.block)) ||
+		!set_item(d, "policy", PyUnicode_FromString(policy_names[cfg.policy])) ||
+		!set_item(d, "accesses", PyLong_FromUnsignedLongLong(c.access)) ||
+		!set_item(d, "read_hits", PyLong_FromUnsignedLongLong(c.read_hit)) ||
+		!set_item(d, "store_hits", PyLong_FromUnsignedLongLong(c.store_hit)) ||
+		!set_item(d, "read_misses", PyLong_FromUnsignedLongLong(c.read_misses)) ||
+		!set_item(d, "store_misses", PyLong_FromUnsignedLongLong(c.store_misses)) ||
+		!set_item(d, "dirty_evictions", PyLong_FromUnsignedLongLong(c.dirty_evicts)) ||
+		!set_item(d, "miss_rate", PyFloat_FromDouble(c.access ? (double)misses/c.access : 0.0)))
+	{
+		Py_XDECREF(d);
+		return nullptr;
+	}
+	return d;
+}
+
+/*
+ * Parses a configuration, like the arguments of Cache.
+ * 
+ * @param[in] size	Cache size in KB.
+ * @param[in] ways	Associativity.
+ * @param[in] block	Block size in bytes.
+ * @param[in] policy	Name of the replacement policy.
+ * @param[out] cfg	Configuration.
+ * @returns bool	False with a Python exception on errors.
+ */
+static bool make_config(int size, int ways, int block, const char *policy, CacheConfig &cfg)
+{
+	cfg.size = size;
+	cfg.ways = ways;
+	cfg.block = block;
+	cfg.policy = parse_policy(policy);
+	if (cfg.policy < 0)
+	{
+		PyErr_Format(PyExc_ValueError, "unknown replacement policy %s", policy);
+		return false;
+	}
+	string error;
+	if (!check_config(cfg, error))
+	{
+		PyErr_SetString(PyExc_ValueError, error.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+static int Cache_init(PyCache *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"size", "ways", "block", "policy", nullptr};
+	int size, ways, block;
+	const char *policy = "srrip";
+	CacheConfig cfg;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iii|s", (char**)kwlist,
+		&size, &ways, &block, &policy))
+		return -1;
+	if (self->busy)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "the cache is running accesses");
+		return -1;
+	}
+	if (!make_config(size, ways, block, policy, cfg))
+		return -1;
+	delete self->cache;
+	self->cache = make_cache(cfg);
+	self->cfg = cfg;
+	return 0;
+}
+
+static void Cache_dealloc(PyCache *self)
+{
+	delete self->cache;
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/*
+ * Checks that a cache can be used by this thread.
+ * 
+ * @param[in] self	Cache.
+ * @returns bool	False with a Python exception if it can't.
+ */
+static bool check_idle(PyCache *self)
+{
+	if (self->cache == nullptr)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "the cache is not initialized");
+		return false;
+	}
+	if (self->busy)
+	{
+		PyErr_SetString(PyExc_RuntimeError, "the cache is running accesses");
+		return false;
+	}
+	return true;
+}
+
+static PyObject* Cache_run(PyCache *self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"addrs", "types", "pcs", nullptr};
+	PyObject *addrs, *types = nullptr, *pcs = nullptr;
+	TraceArrays t;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", (char**)kwlist, &addrs, &types, &pcs) ||
+		!check_idle(self) || !get_trace(addrs, types, pcs, t))
+		return nullptr;
+
+	// the buffers can't be resized while they are borrowed
+	ArraySource src = trace_source(t);
+	CacheModel *cache = self->cache;
+	const Access *batch;
+	size_t n;
+	self->busy = true;
+	Py_BEGIN_ALLOW_THREADS
+	while (src.next(batch, n))
+		cache->run_batch(batch, n);
+	Py_END_ALLOW_THREADS
+	self->busy = false;
+	Py_RETURN_NONE;
+}
+
+static PyObject* Cache_stats(PyCache *self, PyObject *unused)
+{
+	if (!check_idle(self))
+		return nullptr;
+	return stats_dict(self->cfg, self->cache->get_counters());
+}
+
+static PyObject* Cache_reset(PyCache *self, PyObject *unused)
+{
+	if (!check_idle(self))
+		return nullptr;
+	self->cache->reset_counters();
+	Py_RETURN_NONE;
+}
+
+static PyObject* Cache_clear(PyCache *self, PyObject *unused)
+{
+	if (!check_idle(self))
+		return nullptr;
+	self->cache->clear();
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef Cache_methods[] = {
+	{"run", (PyCFunction)(void(*)(void))Cache_run, METH_VARARGS | METH_KEYWORDS,
+		"run(addrs, types=None, pcs=None)\n\nRuns the accesses of the arrays, types "
+		"are 0 for loads and 1 for stores,\nall loads if None."},
+	{"stats", (PyCFunction)Cache_stats, METH_NOARGS,
+		"stats()\n\nReturns the configuration and counters as a dict."},
+	{"reset", (PyCFunction)Cache_reset, METH_NOARGS,
+		"reset()\n\nClears the counters, the lines are kept."},
+	{"clear", (PyCFunction)Cache_clear, METH_NOARGS,
+		"clear()\n\nEmpties the cache and clears the counters."},
+	{nullptr, nullptr, 0, nullptr}
+};
+
+static PyTypeObject CacheType = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+
+/*
+ * Runs a trace in several caches, like the sweeps of the simulator.
+ */
+static PyObject* sweep(PyObject *module, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"configs", "addrs", "types", "pcs", "threads", nullptr};
+	PyObject *list, *addrs, *types = nullptr, *pcs = nullptr;
+	int threads = 1;
+	TraceArrays t;
+	vector<CacheConfig> configs;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|OOi", (char**)kwlist,
+		&list, &addrs, &types, &pcs, &threads))
+		return nullptr;
+
+	// configurations as (size, ways, block[, policy]) tuples
+	PyObject *seq = PySequence_Fast(list, "configs must be a sequence");
+	if (seq == nullptr)
+		return nullptr;
+	for (Py_ssize_t k=0; k<PySequence_Fast_GET_SIZE(seq); k++)
+	{
+		int size, ways, block;
+		const char *policy = "srrip";
+		CacheConfig cfg;
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, k);
+		if (!PyTuple_Check(item) ||
+			!PyArg_ParseTuple(item, "iii|s", &size, &ways, &block, &policy) ||
+			!make_config(size, ways, block, policy, cfg))
+		{
+			if (!PyErr_Occurred() || PyErr_ExceptionMatches(PyExc_TypeError))
+			{
+				PyErr_Clear();
+				PyErr_SetString(PyExc_TypeError, "configs must be (size, ways, block[, policy]) tuples");
+			}
+			Py_DECREF(seq);
+			return nullptr;
+		}
+		configs.push_back(cfg);
+	}
+	Py_DECREF(seq);
+	if (!get_trace(addrs, types, pcs, t))
+		return nullptr;
+
+	ArraySource src = trace_source(t);
+	Sweep s(configs);
+	Py_BEGIN_ALLOW_THREADS
+	s.run(&src, max(threads, 1));
+	Py_END_ALLOW_THREADS
+
+	PyObject *results = PyList_New(s.size());
+	for (size_t k=0; results != nullptr && k<s.size(); k++)
+	{
+		PyObject *d = stats_dict(s.get_config(k), s.get_cache(k).get_counters());
+		if (d == nullptr)
+		{
+			Py_CLEAR(results);
+			break;
+		}
+		PyList_SET_ITEM(results, k, d);
+	}
+	return results;
+}
+
+static PyMethodDef module_methods[] = {
+	{"sweep", (PyCFunction)(void(*)(void))sweep, METH_VARARGS | METH_KEYWORDS,
+		"sweep(configs, addrs, types=None, pcs=None, threads=1)\n\nRuns the accesses "
+		"of the arrays in a cache for each (size, ways, block[, policy])\nconfiguration, "
+		"with up to threads worker threads, and returns the stats\nof each cache as a "
+		"list of dicts."},
+	{nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef cachesim_module = {
+	PyModuleDef_HEAD_INIT, "cachesim",
+	"Cache simulator with SRRIP, BRRIP, DRRIP, LRU and PLRU replacement.",
+	-1, module_methods
+};
+
+PyMODINIT_FUNC PyInit_cachesim()
+{
+	CacheType.tp_name = "cachesim.Cache";
+	CacheType.tp_doc = "Cache(size, ways, block, policy=\"srrip\")\n\nCache of size KB "
+		"with blocks of block bytes.";
+	CacheType.tp_basicsize = sizeof(PyCache);
+	CacheType.tp_flags = Py_TPFLAGS_DEFAULT;
+	CacheType.tp_new = PyType_GenericNew;
+	CacheType.tp_init = (initproc)Cache_init;
+	CacheType.tp_dealloc = (destructor)Cache_dealloc;
+	CacheType.tp_methods = Cache_methods;
+	if (PyType_Ready(&CacheType) < 0)
+		return nullptr;
+
+	PyObject *m = PyModule_Create(&cachesim_module);
+	if (m == nullptr)
+		return nullptr;
+	PyObject *names = PyTuple_New(sizeof(policy_names)/sizeof(policy_names[0]));
+	for (size_t k=0; names != nullptr && k<sizeof(policy_names)/sizeof(policy_names[0]); k++)
+		PyTuple_SET_ITEM(names, k, PyUnicode_FromString(policy_names[k]));
+	Py_INCREF(&CacheType);
+	if (names == nullptr || PyModule_AddObject(m, "policies", names) < 0 ||
+		PyModule_AddObject(m, "Cache", (PyObject*)&CacheType) < 0)
+	{
+		Py_XDECREF(names);
+		Py_DECREF(&CacheType);
+		Py_DECREF(m);
+		return nullptr;
+	}
+	return m;
+}
@@ -0,0 +1,459 @@
+/*
+ * Checks of the cache model, built and run with make test.
+ */
+
+#include "cachesim.h"
+
+using namespace std;
+using namespace cachesim;
+
+/*
+ * Runs a list of accesses in a hierarchy.
+ * 
+ * @param[in] hier	Hierarchy.
+ * @param[in] accesses	Accesses to run.
+ */
+void run_accesses(CacheHierarchy &hier, const vector<Access> &accesses)
+{
+	vector<uint64_t> addrs;
+	vector<uint8_t> types;
+	for (const Access &a : accesses)
+	{
+		addrs.push_back(a.phy_addr);
+		types.push_back(a.ls);
+	}
+	ArraySource src(addrs.data(), types.data(), nullptr, addrs.size());
+	hier.run(&src);
+}
+
+/*
+ * Runs loads of a list of addresses in a cache.
+ * 
+ * @param[in] ch	Cache.
+ * @param[in] addrs	Addresses to load.
+ * @returns double	Miss rate of the cache.
+ */
+double run_loads(CacheModel &ch, const vector<uint64_t> &addrs)
+{
+	ArraySource src(addrs.data(), nullptr, nullptr, addrs.size());
+	const Access *batch;
+	size_t n;
+	while (src.next(batch, n))
+		ch.run_batch(batch, n);
+	return (double)ch.get_read_misses_cnt()/ch.get_access_cnt();
+}
+
+/*
+ * Loads lines of a single set cache and checks the lines it evicts.
+ * 
+ * @param[in] name	Name of the check.
+ * @param[in] ch	Cache with a single set.
+ * @param[in] lines	Lines to load, in order.
+ * @param[in] victims	Lines evicted, in order.
+ * @param[in] hits	Loads that hit.
+ * @returns bool	The check passed.
+ */
+bool check_set(const char *name, CacheModel &ch, const vector<uint64_t> &lines,
+	const vector<uint64_t> &victims, uint64_t hits)
+{
+	vector<uint64_t> evicted;
+	for (uint64_t line : lines)
+	{
+		Victim victim;
+		ch.access(0, line*ch.get_block_size(), victim);
+		if (victim.valid)
+			evicted.push_back(victim.phy_addr/ch.get_block_size());
+	}
+	if (evicted != victims || ch.get_read_hit_cnt() != hits)
+	{
+		fprintf(stderr, "%s: %" PRIu64 " hits, evicted", name, ch.get_read_hit_cnt());
+		for (uint64_t line : evicted)
+			fprintf(stderr, " %" PRIu64, line);
+		fprintf(stderr, "\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Synthetic trace of the equivalence checks: zipf over 8 MB with a
+ * quarter of stores.
+ * 
+ * @returns SyntheticConfig	Parameters of the trace.
+ */
+SyntheticConfig test_trace()
+{
+	SyntheticConfig cfg = synthetic_defaults(SYNTH_ZIPF);
+	cfg.accesses = 400000;
+	cfg.footprint = 8<<20;
+	cfg.seed = 7;
+	return cfg;
+}
+
+/*
+ * Compares the counters and the policy state of two caches.
+ * 
+ * @param[in] name	Name of the check.
+ * @param[in] a	Cache.
+ * @param[in] b	Reference cache.
+ * @returns bool	The caches have the same counters.
+ */
+bool same_counters(const char *name, CacheModel &a, CacheModel &b)
+{
+	CacheCounters x = a.get_counters();
+	CacheCounters y = b.get_counters();
+	if (x.access != y.access || x.read_hit != y.read_hit || x.store_hit != y.store_hit
+		|| x.read_misses != y.read_misses || x.store_misses != y.store_misses
+		|| x.dirty_evicts != y.dirty_evicts || a.get_policy_state() != b.get_policy_state())
+	{
+		fprintf(stderr, "%s: %" PRIu64 " accesses, %" PRIu64 " misses, %" PRIu64
+			" dirty evictions, expected %" PRIu64 ", %" PRIu64 " and %" PRIu64 "\n",
+			name, x.access, x.read_misses+x.store_misses, x.dirty_evicts, y.access,
+			y.read_misses+y.store_misses, y.dirty_evicts);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Hits and victims of each policy on a single set, worked by hand.
+ * The lines are numbered, the set starts empty.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_policies()
+{
+	bool ok = true;
+	// 4 ways of 256 bytes and 8 ways of 128 bytes give a single set
+	unique_ptr<CacheModel> lru(make_cache(1, 4, 256, POLICY_LRU));
+	unique_ptr<CacheModel> plru(make_cache(1, 4, 256, POLICY_PLRU));
+	unique_ptr<CacheModel> plru8(make_cache(1, 8, 128, POLICY_PLRU));
+	unique_ptr<CacheModel> lru8(make_cache(1, 8, 128, POLICY_LRU));
+	unique_ptr<CacheModel> srrip(make_cache(1, 4, 256, POLICY_SRRIP));
+	unique_ptr<CacheModel> brrip(make_cache(1, 4, 256, POLICY_BRRIP));
+
+	// 0-3 fill the ways 0, 2, 1 and 3 of PLRU, they are used again in
+	// the order of the ways and 0 once more. LRU evicts the oldest, 2,
+	// PLRU follows the tree to the right half, to way 2 with line 1
+	vector<uint64_t> seq = {0, 1, 2, 3, 0, 2, 1, 3, 0, 4, 5};
+	ok &= check_set("lru", *lru, seq, {2, 1}, 5);
+	ok &= check_set("plru 4 ways", *plru, seq, {1, 2}, 5);
+
+	// 0-7 fill the ways 0, 4, 2, 6, 1, 5, 3 and 7, are used in the order
+	// of the ways, then 0 again. LRU evicts 4, the line of way 1, PLRU
+	// goes to the right half and evicts way 4 with line 1, then the
+	// misses walk the tree
+	vector<uint64_t> seq8 = {0, 1, 2, 3, 4, 5, 6, 7, 0, 4, 2, 6, 1, 5, 3, 7, 0,
+		8, 9, 10, 11};
+	ok &= check_set("lru 8 ways", *lru8, seq8, {4, 2, 6, 1}, 9);
+	ok &= check_set("plru 8 ways", *plru8, seq8, {1, 2, 3, 4}, 9);
+
+	// SRRIP inserts at RRPV 2 of 3, the hit takes 0 to RRPV 0 and the
+	// misses age the set, so 0 outlives 1, 2 and 3
+	ok &= check_set("srrip", *srrip, {0, 1, 2, 3, 0, 4, 5, 6, 0}, {1, 2, 3}, 2);
+
+	// BRRIP inserts most lines at RRPV 3, the stream evicts the new
+	// lines and 0 keeps hitting
+	vector<uint64_t> stream = {0, 1, 2, 3, 0};
+	for (uint64_t k=4; k<20; k++)
+		stream.push_back(k);
+	stream.push_back(0);
+	Victim victim;
+	for (uint64_t line : stream)
+		brrip->access(0, line*256, victim);
+	if (brrip->get_read_hit_cnt() != 2)
+	{
+		fprintf(stderr, "brrip: %" PRIu64 " hits, expected 2\n", brrip->get_read_hit_cnt());
+		ok = false;
+	}
+	return ok;
+}
+
+/*
+ * The PSEL counter of DRRIP moves towards the leaders with less misses,
+ * on a loop that thrashes SRRIP it selects BRRIP.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_drrip_psel()
+{
+	// 512 sets, with 32 leaders of each policy
+	unique_ptr<CacheModel> drrip(make_cache(256, 8, 64, POLICY_DRRIP));
+	int64_t start = drrip->get_policy_state();
+	vector<uint64_t> addrs;
+	for (int pass=0; pass<20; pass++)
+		for (uint64_t k=0; k<8192; k++)
+			addrs.push_back(k*64);
+	run_loads(*drrip, addrs);
+	int64_t psel = drrip->get_policy_state();
+	if (psel <= start+start/2)
+	{
+		fprintf(stderr, "drrip psel: %" PRId64 ", started at %" PRId64 "\n", psel, start);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A cyclic working set twice the size of the cache thrashes SRRIP and
+ * LRU, the bimodal insertion of BRRIP must keep part of it.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_brrip_thrash()
+{
+	vector<uint64_t> addrs;
+	for (int pass=0; pass<200; pass++)
+		for (uint64_t k=0; k<1024; k++)
+			addrs.push_back(k*64);
+	double rate[3];
+	int policies[3] = {POLICY_BRRIP, POLICY_SRRIP, POLICY_LRU};
+	for (int p=0; p<3; p++)
+	{
+		unique_ptr<CacheModel> ch(make_cache(32, 8, 64, policies[p]));
+		rate[p] = run_loads(*ch, addrs);
+	}
+	if (rate[0] > 0.7 || rate[0] > rate[1]-0.2 || rate[0] > rate[2]-0.2)
+	{
+		fprintf(stderr, "brrip thrash: miss rates brrip %.4f, srrip %.4f, lru %.4f\n",
+			rate[0], rate[1], rate[2]);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A modified line that an exclusive L3 sends back up must still be
+ * written to memory once it leaves the hierarchy.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_exclusive_dirty_reload()
+{
+	// direct mapped L1 and L2, the lines 4 KB apart share a set in all
+	// the levels
+	vector<CacheConfig> cfgs = {{1, 1, 64, POLICY_LRU}, {2, 1, 64, POLICY_LRU},
+		{8, 2, 64, POLICY_LRU}};
+	CacheHierarchy hier(cfgs, INCLUSION_EXCLUSIVE);
+	vector<Access> accesses;
+	// the store leaves the line modified in L1, two more lines push it
+	// down to L3, and the load takes it back to L1
+	accesses.push_back({1, 0, 0, 0});
+	accesses.push_back({0, 0, 4096, 0});
+	accesses.push_back({0, 0, 8192, 0});
+	accesses.push_back({0, 0, 0, 0});
+	// more lines of the set write it to memory
+	for (uint64_t k=3; k<16; k++)
+		accesses.push_back({0, 0, k*4096, 0});
+	run_accesses(hier, accesses);
+
+	if (hier.get_stats(2).accesses == 0 || hier.get_stats(2).misses == hier.get_stats(2).accesses)
+	{
+		fprintf(stderr, "exclusive reload: the line didn't come from L3\n");
+		return false;
+	}
+	if (hier.get_memory_writes() != 1)
+	{
+		fprintf(stderr, "exclusive reload: %" PRIu64 " memory writes, expected 1\n",
+			hier.get_memory_writes());
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Sharded caches must reject DRRIP, its PSEL counter is shared by all
+ * the sets.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_sharded_drrip()
+{
+	try
+	{
+		ShardedCache sharded({32, 8, 64, POLICY_DRRIP}, 4);
+	}
+	catch (const invalid_argument &)
+	{
+		return true;
+	}
+	fprintf(stderr, "sharded drrip: the cache was created\n");
+	return false;
+}
+
+/*
+ * The shards of a sharded cache must count the same as a single cache,
+ * and a sweep the same with one or four threads.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_sharded_equal()
+{
+	bool ok = true;
+	int policies[4] = {POLICY_SRRIP, POLICY_LRU, POLICY_PLRU, POLICY_BRRIP};
+	vector<CacheConfig> cfgs;
+	for (int p=0; p<4; p++)
+	{
+		CacheConfig cfg = {256, 8, 64, policies[p]};
+		cfgs.push_back(cfg);
+		unique_ptr<CacheModel> single(make_cache(cfg));
+		unique_ptr<AccessSource> src(open_synthetic(test_trace()));
+		const Access *batch;
+		size_t n;
+		while (src->next(batch, n))
+			single->run_batch(batch, n);
+
+		ShardedCache sharded(cfg, 4);
+		src.reset(open_synthetic(test_trace()));
+		sharded.run(src.get());
+		string name = string("sharded ")+policy_names[policies[p]];
+		ok &= same_counters(name.c_str(), sharded.get_cache(), *single);
+	}
+
+	cfgs.push_back({64, 4, 64, POLICY_DRRIP});
+	cfgs.push_back({1024, 16, 64, POLICY_DRRIP});
+	Sweep one(cfgs);
+	Sweep four(cfgs);
+	unique_ptr<AccessSource> src(open_synthetic(test_trace()));
+	one.run(src.get(), 1);
+	src.reset(open_synthetic(test_trace()));
+	four.run(src.get(), 4);
+	for (size_t k=0; k<cfgs.size(); k++)
+	{
+		string name = string("sweep ")+policy_names[cfgs[k].policy];
+		ok &= same_counters(name.c_str(), four.get_cache(k), one.get_cache(k));
+	}
+	return ok;
+}
+
+/*
+ * Plain and delta binary traces must read back the addresses, types and
+ * instructions written, also for addresses with the top bit set.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_convert_roundtrip()
+{
+	vector<uint64_t> addrs;
+	vector<uint8_t> types;
+	vector<uint64_t> pcs;
+	unique_ptr<AccessSource> src(open_synthetic(test_trace()));
+	const Access *batch;
+	size_t n;
+	while (src->next(batch, n))
+	{
+		for (size_t k=0; k<n; k++)
+		{
+			addrs.push_back(batch[k].phy_addr);
+			types.push_back(batch[k].ls);
+			// small steps of the instructions and some far jumps
+			pcs.push_back(0x400000+(addrs.size()%97)*4+(addrs.size()%1000 == 0 ? 1ULL<<40 : 0));
+		}
+	}
+	// jumps to and from the top of the address space
+	uint64_t top[] = {1ULL<<63, ~0ULL-63, 64, (1ULL<<63)+4096, 0};
+	for (uint64_t a : top)
+	{
+		addrs.push_back(a);
+		types.push_back(1);
+		pcs.push_back(a|1);
+	}
+
+	bool ok = true;
+	const char *path = "test_cachesim.tmp";
+	for (int delta=0; delta<2; delta++)
+	{
+		ArraySource in(addrs.data(), types.data(), pcs.data(), addrs.size());
+		if (convert_trace(&in, path, delta) != 0)
+			return false;
+		unique_ptr<AccessSource> out(open_accesses(path));
+		size_t pos = 0;
+		while (ok && out && out->next(batch, n))
+		{
+			for (size_t k=0; k<n && pos<addrs.size(); k++, pos++)
+			{
+				if (batch[k].phy_addr != addrs[pos] || batch[k].pc != pcs[pos]
+					|| batch[k].ls != types[pos])
+				{
+					fprintf(stderr, "%s round trip: access %zu is %d %#" PRIx64 " %#" PRIx64
+						", expected %d %#" PRIx64 " %#" PRIx64 "\n", delta ? "delta" : "plain",
+						pos, batch[k].ls, batch[k].phy_addr, batch[k].pc, types[pos],
+						addrs[pos], pcs[pos]);
+					ok = false;
+					break;
+				}
+			}
+		}
+		if (ok && pos != addrs.size())
+		{
+			fprintf(stderr, "%s round trip: %zu accesses, expected %zu\n",
+				delta ? "delta" : "plain", pos, addrs.size());
+			ok = false;
+		}
+	}
+	remove(path);
+	return ok;
+}
+
+/*
+ * A sweep stopped at a checkpoint and resumed from it must end like a
+ * sweep run without stopping, also the PSEL counter of DRRIP.
+ * 
+ * @returns bool	The check passed.
+ */
+bool test_checkpoint_resume()
+{
+	vector<CacheConfig> cfgs = {{64, 4, 64, POLICY_DRRIP}, {256, 8, 64, POLICY_SRRIP},
+		{256, 8, 64, POLICY_BRRIP}, {128, 8, 64, POLICY_PLRU}, {32, 2, 128, POLICY_LRU}};
+	uint64_t half = test_trace().accesses/2+123;
+	const char *path = "test_cachesim.tmp";
+
+	Sweep whole(cfgs);
+	unique_ptr<AccessSource> src(open_synthetic(test_trace()));
+	whole.run(src.get(), 1);
+
+	Sweep first(cfgs);
+	src.reset(new TraceWindow(open_synthetic(test_trace()), 0, half));
+	first.run(src.get(), 1);
+	if (!save_checkpoint(path, first, half))
+		return false;
+	vector<CacheConfig> loaded;
+	uint64_t offset;
+	FILE *f = open_checkpoint(path, loaded, offset);
+	if (f == nullptr || loaded.size() != cfgs.size() || offset != half)
+	{
+		fprintf(stderr, "checkpoint: wrong configurations or offset\n");
+		if (f != nullptr)
+			fclose(f);
+		remove(path);
+		return false;
+	}
+	Sweep resumed(loaded);
+	bool ok = load_checkpoint(f, resumed);
+	remove(path);
+	if (!ok)
+		return false;
+	src.reset(new TraceWindow(open_synthetic(test_trace()), offset, 0));
+	resumed.run(src.get(), 1);
+	for (size_t k=0; k<cfgs.size(); k++)
+	{
+		string name = string("checkpoint ")+policy_names[cfgs[k].policy];
+		ok &= same_counters(name.c_str(), resumed.get_cache(k), whole.get_cache(k));
+	}
+	return ok;
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= test_exclusive_dirty_reload();
+	ok &= test_sharded_drrip();
+	ok &= test_brrip_thrash();
+	ok &= test_policies();
+	ok &= test_drrip_psel();
+	ok &= test_sharded_equal();
+	ok &= test_convert_roundtrip();
+	ok &= test_checkpoint_resume();
+	printf("%s\n", ok ? "all tests passed" : "some tests failed");
+	return ok ? 0 : 1;
+}